@@ -1,4 +1,3 @@
 #!/bin/bash
 
-make -C /usr/src/linux-source-3.11.0/linux-source-3.11.0 M=`pwd` modules
-
+make -C /lib/modules/`uname -r`/build M=`pwd` modules
@@ -0,0 +1,585 @@
+/*
+ * Histogram, sampling and training core of the stoch driver. Nothing here
+ * depends on the kernel: the same code is built into the module and into
+ * libstoch.a for benchmarking and testing in userspace, see stoch_plat.h.
+ */
+
+#ifndef STOCH_H
+#define STOCH_H
+
+#include "stoch_plat.h"
+#include "stochdev.h"
+
+#define STOCH_HIST_SIZE 256
+
+// rows are line aligned so every group of 16 bins shares one cache line
+struct _stoch_hist {
+	unsigned int data[STOCH_HIST_SIZE];
+	unsigned int total;
+} STOCH_CACHE_ALIGNED;
+
+/* ------- samplers --------------- */
+
+// the available algorithms for drawing a value from a histogram, see stochdev.h
+#define STOCH_SAMPLER_COUNT 4
+
+extern const char *const stoch_sampler_names[STOCH_SAMPLER_COUNT];
+
+// map a sampler name (e.g. from a module parameter) to its STOCH_SAMPLER_ value
+int stoch_sampler_parse( const char *name );
+
+/* ------- modes --------------- */
+
+// how a model ages its training data, see stochdev.h
+#define STOCH_MODE_COUNT 3
+
+extern const char *const stoch_mode_names[STOCH_MODE_COUNT];
+
+int stoch_mode_parse( const char *name );
+
+/* ------- rng --------------- */
+
+// where the samplers get their random words from, see stochdev.h
+#define STOCH_RNG_COUNT 2
+
+extern const char *const stoch_rng_names[STOCH_RNG_COUNT];
+
+int stoch_rng_parse( const char *name );
+
+#define STOCH_RNG_BATCH 32 // words generated per refill
+#define STOCH_RNG_RESEED (1 << 16) // fast mode words between reseeds
+
+/*
+ * Per-reader generator state. Random words are produced STOCH_RNG_BATCH at a
+ * time into buf and handed out from there. In fast mode each reader's
+ * xoshiro state comes from stoch_plat_seed and is replaced every
+ * STOCH_RNG_RESEED words.
+ */
+struct _stoch_rng {
+	u64 s[4];
+	u64 buf[STOCH_RNG_BATCH];
+	unsigned int pos;
+	unsigned int count;
+	int mode;
+};
+
+static inline u64 stoch_xoshiro_next( u64 *s ) {
+	u64 result, t;
+
+	result = rol64( s[1] * 5, 7 ) * 9;
+	t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rol64( s[3], 45 );
+
+	return result;
+}
+
+void stoch_rng_init( struct _stoch_rng *r, int mode );
+void stoch_rng_refill( struct _stoch_rng *r );
+
+// next random word
+static inline u64 stoch_rng_next( struct _stoch_rng *r ) {
+	if (r->pos == STOCH_RNG_BATCH) {
+		stoch_rng_refill( r );
+	}
+	return r->buf[r->pos++];
+}
+
+/* ------- alias table --------------- */
+
+/*
+ * Walker/Vose alias table derived from a histogram. Bin i is kept with
+ * probability prob[i]/total, otherwise its alias is returned, so a sample
+ * is one random draw, one lookup and one compare regardless of the data.
+ */
+struct _stoch_alias {
+	unsigned int prob[STOCH_HIST_SIZE];
+	unsigned char alias[STOCH_HIST_SIZE];
+	unsigned int total;
+};
+
+/*
+ * Build the table with exact integer arithmetic: bin weights are scaled by
+ * STOCH_HIST_SIZE so the average weight is total and every threshold fits
+ * in [0, total]. w is caller supplied scratch space of STOCH_HIST_SIZE entries.
+ */
+void stoch_alias_build( struct _stoch_alias *a, const struct _stoch_hist *h, u64 *w );
+
+// generate a random value from the alias table
+static inline unsigned char stoch_alias_val( const struct _stoch_alias *a, struct _stoch_rng *rng ) {
+	u64 r;
+	unsigned int slot, u;
+
+	// if no data has been written to the histogram then just return 0
+	if (a->total == 0) {
+		return 0;
+	}
+
+	// low bits pick the slot, the high word is scaled into [0, total)
+	r = stoch_rng_next( rng );
+	slot = (unsigned int)r & (STOCH_HIST_SIZE - 1);
+	u = (unsigned int)(((r >> 32) * a->total) >> 32);
+
+	return (u < a->prob[slot]) ? slot : a->alias[slot];
+}
+
+/*
+ * The alias table quantized for sampling: prob[i] is the chance of keeping
+ * slot i out of 65536 and a draw needs no total. Slots with no count are
+ * never kept and never an alias, and an empty table is all zero, so it
+ * draws 0 without a branch. Each keep probability is within 2^-16 of the
+ * exact table it was built from.
+ *
+ * A dense table has a slot for every bin, 832 bytes. Most rows trained on
+ * text only ever see a handful of successors though, and a row with no
+ * more than STOCH_SPARSE_MAX has a slot for each of those alone, holding
+ * the value itself; the table is then 64 bytes and the rest of its struct
+ * _stoch_dist is not even allocated.
+ */
+#define STOCH_SPARSE_MAX 16 // most values a sparse row holds, a power of two
+
+struct _stoch_qalias {
+	unsigned int total; // of the histogram, for callers
+	unsigned int dense; // which of bins or vals holds the table
+	union {
+		struct {
+			u16 prob[STOCH_HIST_SIZE];
+			unsigned char alias[STOCH_HIST_SIZE];
+		} bins;
+		struct {
+			u16 prob[STOCH_SPARSE_MAX];
+			unsigned char val[STOCH_SPARSE_MAX];
+			unsigned char alias[STOCH_SPARSE_MAX];
+		} vals;
+	};
+} STOCH_CACHE_ALIGNED;
+
+// build the dense table of a
+void stoch_qalias_build( struct _stoch_qalias *q, const struct _stoch_alias *a );
+
+static inline unsigned char stoch_qalias_val( const struct _stoch_qalias *q, struct _stoch_rng *rng ) {
+	u64 r;
+	unsigned int slot, u, keep;
+
+	// low bits pick the slot, the top 16 bits decide between it and its alias
+	r = stoch_rng_next( rng );
+	u = (unsigned int)(r >> 48);
+	if (q->dense) {
+		slot = (unsigned int)r & (STOCH_HIST_SIZE - 1);
+		return (u < q->bins.prob[slot]) ? slot : q->bins.alias[slot];
+	}
+
+	// every slot of a sparse row is likely to be partly kept, so choose with a mask, not a branch
+	slot = (unsigned int)r & (STOCH_SPARSE_MAX - 1);
+	keep = -(unsigned int)(u < q->vals.prob[slot]);
+	return (q->vals.val[slot] & keep) | (q->vals.alias[slot] & ~keep);
+}
+
+/* ------- cdf --------------- */
+
+#define STOCH_CDF_LINE 16 // cumulative counts per cache line
+
+/*
+ * cdf[i] is the sum of bins 0 to i, so cdf[STOCH_HIST_SIZE - 1] is the
+ * total. top[i] repeats the last count of each line of cdf, so a search
+ * reads the single line of top and then one line of cdf.
+ */
+struct _stoch_cdf {
+	unsigned int top[STOCH_HIST_SIZE / STOCH_CDF_LINE] STOCH_CACHE_ALIGNED;
+	unsigned int cdf[STOCH_HIST_SIZE] STOCH_CACHE_ALIGNED;
+};
+
+void stoch_cdf_build( struct _stoch_cdf *c, const struct _stoch_hist *h );
+
+/*
+ * Generate a random value by binary search for the first bin whose
+ * cumulative count passes a draw in [0, total): first for the line in top,
+ * then within that line of cdf. Both sizes are powers of two, so the
+ * search is a fixed eight steps with no data dependent branches.
+ */
+static inline unsigned char stoch_cdf_val( const struct _stoch_cdf *c, struct _stoch_rng *rng ) {
+	unsigned int total, u, pos, step;
+
+	// if no data has been written to the histogram then just return 0
+	total = c->top[STOCH_HIST_SIZE / STOCH_CDF_LINE - 1];
+	if (total == 0) {
+		return 0;
+	}
+
+	u = (unsigned int)(((stoch_rng_next( rng ) >> 32) * total) >> 32);
+	pos = 0;
+	for (step = STOCH_HIST_SIZE / STOCH_CDF_LINE / 2; step > 0; step >>= 1) {
+		pos += (c->top[pos + step - 1] <= u) ? step : 0;
+	}
+	pos *= STOCH_CDF_LINE;
+	for (step = STOCH_CDF_LINE / 2; step > 0; step >>= 1) {
+		pos += (c->cdf[pos + step - 1] <= u) ? step : 0;
+	}
+
+	return pos;
+}
+
+/* ------- frequency order --------------- */
+
+/*
+ * The bins of a histogram by descending count for the scan sampler. Only
+ * the first used entries have a non-zero count, so on skewed data a scan
+ * ends after a few steps for the common values.
+ */
+struct _stoch_order {
+	unsigned char bin[STOCH_HIST_SIZE];
+	unsigned int used;
+};
+
+/*
+ * Sort the bins of h into o starting from hint, an earlier order of the
+ * same row (which may be o itself) or NULL. Counts move little between
+ * rebuilds so the sort from a hint is close to linear.
+ */
+void stoch_order_build( struct _stoch_order *o, const struct _stoch_hist *h, const struct _stoch_order *hint );
+
+/* ------- distributions --------------- */
+
+/*
+ * A histogram's sampling table for one sampler. The driver publishes one
+ * per context (a row) plus one for the start state, and only rebuilds the
+ * rows that training has touched. A dense row holds only the table of the
+ * sampler it was built for, overlaid after the total and dense of qalias,
+ * which every row keeps: alias is qalias, cdf is cdf and scan is order
+ * together with the histogram. A sparse row is only the start of qalias
+ * and every sampler draws from that, see stoch_dist_size.
+ */
+struct _stoch_dist {
+	union {
+		struct _stoch_qalias qalias;
+		struct {
+			unsigned int cdf_head[2]; // qalias.total and qalias.dense
+			struct _stoch_cdf cdf STOCH_CACHE_ALIGNED;
+		};
+		struct {
+			unsigned int scan_head[2]; // qalias.total and qalias.dense
+			struct _stoch_order order STOCH_CACHE_ALIGNED;
+			struct _stoch_hist hist;
+		};
+	};
+};
+
+// scratch space for building a distribution
+struct _stoch_build {
+	struct _stoch_hist hist; // somewhere to gather the counts of a row that may be sparse
+	u64 w[STOCH_HIST_SIZE];
+	struct _stoch_alias alias; // left holding the exact alias table, e.g. for the mmap copy
+};
+
+// the bytes of struct _stoch_dist a distribution of h needs for sampler, less for a sparse row
+size_t stoch_dist_size( const struct _stoch_hist *h, int sampler );
+
+/*
+ * Total up the bins of h and build the table sampler draws from into d,
+ * which has at least stoch_dist_size( h, sampler ) bytes; h may be d's own
+ * hist. Any sampler but cdf and scan gets qalias. prev is the snapshot d
+ * replaces, built for the same sampler, or NULL, and seeds the frequency
+ * order.
+ */
+void stoch_dist_build( struct _stoch_dist *d, const struct _stoch_dist *prev, struct _stoch_hist *h, int sampler,
+		       struct _stoch_build *b );
+
+// draw a value with scan, alias or cdf, the sampler d was built for, 0 if the histogram is empty
+unsigned char stoch_dist_val( int sampler, const struct _stoch_dist *d, struct _stoch_rng *rng );
+
+// fill a histogram with one of the STOCH_BENCH_ synthetic distributions
+void stoch_hist_synth( struct _stoch_hist *h, int dist );
+
+/* ------- fenwick --------------- */
+
+/*
+ * Binary indexed tree over the bins of a histogram: node[i - 1] holds the
+ * sum of the i & -i bins ending at bin i - 1. Adding to a bin and drawing
+ * a value both touch at most log2(STOCH_HIST_SIZE) + 1 nodes, so the tree
+ * can be trained and sampled at the same time without any rebuilds. The
+ * nodes are accessed with READ_ONCE/WRITE_ONCE, the caller decides what a
+ * draw that races an update means.
+ *
+ * The root holds the total, so adding must not take it past
+ * STOCH_FENWICK_MAX; a full tree is halved first.
+ */
+#define STOCH_FENWICK_MAX 0xffffffffU // largest total a tree holds
+struct _stoch_fenwick {
+	unsigned int node[STOCH_HIST_SIZE];
+} STOCH_CACHE_ALIGNED;
+
+static inline unsigned int stoch_fenwick_total( const struct _stoch_fenwick *f ) {
+	return READ_ONCE( f->node[STOCH_HIST_SIZE - 1] );
+}
+
+static inline void stoch_fenwick_add( struct _stoch_fenwick *f, unsigned char x, unsigned int n ) {
+	unsigned int i;
+
+	for (i = x + 1; i <= STOCH_HIST_SIZE; i += i & -i) {
+		WRITE_ONCE( f->node[i - 1], f->node[i - 1] + n );
+	}
+}
+
+// build a tree holding the counts of h
+void stoch_fenwick_build( struct _stoch_fenwick *f, const struct _stoch_hist *h );
+
+/*
+ * Halve every bin of the tree, rounding up so none that was counted drops
+ * to 0. The nodes are rewritten in place, so a draw racing it has to be
+ * retried.
+ */
+void stoch_fenwick_halve( struct _stoch_fenwick *f );
+
+// generate a random value by descending the tree, 0 if it is empty
+unsigned char stoch_fenwick_val( const struct _stoch_fenwick *f, struct _stoch_rng *rng );
+
+/*
+ * Count training data into the row trees, the row for each byte being the
+ * byte before it masked, and each row used into the start-state tree.
+ * A tree whose total is about to wrap is halved first. Returns the context
+ * of the next byte.
+ */
+u64 stoch_fenwick_count( struct _stoch_fenwick *rows, struct _stoch_fenwick *start, unsigned int mask, u64 prev,
+			 const unsigned char *buff, size_t size );
+
+/* ------- chains --------------- */
+
+// state of one generated chain
+struct _stoch_chain {
+	struct _stoch_rng rng;
+	u64 ctx; // the last order bytes generated, most recent in the low byte
+	int started;
+};
+
+// start a chain from a state drawn in constant time from start, whose bin i holds the total of row i
+void stoch_chain_start( struct _stoch_chain *c, const struct _stoch_dist *start );
+
+/*
+ * Continue a started chain into buff through rows, the row for a context
+ * being rows[ctx & mask]. Generation stops at a 0, which also ends the
+ * chain, and the number of bytes before it is returned. In the kernel the
+ * caller holds rcu_read_lock.
+ */
+size_t stoch_chain_gen( struct _stoch_chain *c, int sampler, struct _stoch_dist __rcu *const *rows,
+			unsigned int mask, unsigned char *buff, size_t size );
+
+/* ------- contexts --------------- */
+
+/*
+ * For orders above 1 the model is a hash table of contexts, a context
+ * being the last order bytes packed into a u64. Each context owns a sparse
+ * row of the successors seen after it, so memory grows with the contexts
+ * actually observed rather than with 256^order.
+ *
+ * A row keeps its successors sorted by count, so the common ones are
+ * found first both when training and when drawing. Once a row has seen
+ * more than STOCH_SROW_MAX successors it is replaced by one holding them
+ * in a struct _stoch_fenwick instead, which is no bigger than the row
+ * would have grown to and trains and draws in log2(STOCH_HIST_SIZE) + 1
+ * steps however flat the row is.
+ *
+ * The caller serializes training, readers probe the table under RCU. A
+ * count is always bumped before its row total, so a reader that loads the
+ * total first always finds its bin. Rows and the table are replaced, never
+ * resized in place, when they fill. A row whose total is about to wrap has
+ * its counts halved in place; a draw racing that, or a successor moving up
+ * the row past others, may come out with the wrong odds or fall through to
+ * the row's last successor.
+ *
+ * Training counts each pair of a context and its successor in the buffer
+ * into a struct _stoch_cbatch first, as stoch_count_pairs does for order 1,
+ * then writes each count into its row and each row's total, its block's
+ * sums and the table's total once for the lot, rather than once a byte.
+ *
+ * The table also sums the row totals of each block of STOCH_CTAB_BLOCK
+ * slots, and all of them, so a chain starts from a context drawn by how
+ * often it was trained, as the order 0 and 1 start table does. The block
+ * sums are kept as a binary indexed tree, laid out as struct _stoch_fenwick
+ * is, so finding the block a draw falls in takes log2 of the number of
+ * blocks steps however big the table grows. The sums follow the same rule:
+ * a row total is raised before its block's nodes and those before the
+ * table's total, and lowered the other way round.
+ */
+struct _stoch_srow {
+	struct rcu_head rcu;
+	u64 ctx;
+	unsigned int total;
+	unsigned int n, cap; // successors in e[], 0 and 0 if the row is a tree
+	struct _stoch_fenwick *tree; // successors of a busy row, NULL if they are in e[]
+	struct {
+		unsigned int count;
+		unsigned char sym;
+	} e[];
+};
+
+struct _stoch_ctab {
+	struct rcu_head rcu;
+	unsigned int mask; // number of slots - 1
+	unsigned int used;
+	u64 total; // of every row
+	u64 *sums; // tree over the rows of each block, after the slots
+	struct _stoch_srow __rcu *slots[];
+};
+
+#define STOCH_CTAB_MIN 1024 // initial number of slots
+#define STOCH_CTAB_BLOCK 64 // slots summed together for drawing a start
+#define STOCH_SROW_MIN 4 // initial successors per row
+#define STOCH_SROW_MAX 64 // successors a row holds before it becomes a tree
+
+#define STOCH_CBATCH_CTXS 1024 // contexts gathered before their rows are written
+#define STOCH_CBATCH_PAIRS 4096 // pairs of a context and a successor gathered
+#define STOCH_CBATCH_BYTES 65536 // bytes gathered at most
+#define STOCH_CBATCH_AHEAD 8 // bytes ahead whose context is prefetched
+
+// training data gathered by context and successor, the writer's alone
+struct _stoch_cbatch {
+	u16 cindex[2 * STOCH_CBATCH_CTXS]; // 1 + the entry of a context, by its hash
+	u16 pindex[2 * STOCH_CBATCH_PAIRS]; // 1 + the entry of a pair, by its hash
+	unsigned int nctxs, npairs;
+	u64 ctx; // the context after the bytes gathered
+	struct {
+		u64 ctx;
+		struct _stoch_srow *row; // with room for every successor of the pairs
+		unsigned int slot; // of row
+		unsigned int fresh; // room in row kept for successors of the pairs it may not have
+		unsigned int add; // bytes gathered after ctx
+	} c[STOCH_CBATCH_CTXS];
+	struct {
+		u64 ctx;
+		unsigned int count;
+		u16 c; // entry of ctx
+		unsigned char sym;
+	} p[STOCH_CBATCH_PAIRS];
+};
+
+struct _stoch_ctxs {
+	struct _stoch_ctab __rcu *ctab;
+	u64 mask; // keeps the low order bytes of a context
+	struct _stoch_cbatch *batch;
+};
+
+// an empty table for contexts of order bytes, -ENOMEM if it cannot be allocated
+int stoch_ctxs_init( struct _stoch_ctxs *x, int order );
+void stoch_ctxs_free( struct _stoch_ctxs *x );
+
+/*
+ * Count a buffer of training data into the table, moving *ctx on past
+ * each byte counted. Returns how many were, or -ENOMEM if none.
+ */
+ssize_t stoch_ctxs_train( struct _stoch_ctxs *x, u64 *ctx, const unsigned char *buff, size_t size );
+
+/*
+ * The readers, which in the kernel hold rcu_read_lock. A successor of ctx,
+ * 0 if it was never seen; starting a chain from a known context, drawn by
+ * how often it was trained; and continuing one into buff, as
+ * stoch_chain_gen does.
+ */
+unsigned char stoch_ctxs_val( const struct _stoch_ctxs *x, u64 ctx, struct _stoch_rng *rng );
+void stoch_ctxs_start( const struct _stoch_ctxs *x, struct _stoch_chain *c );
+size_t stoch_ctxs_gen( const struct _stoch_ctxs *x, struct _stoch_chain *c, unsigned char *buff, size_t size );
+
+/* ------- counts --------------- */
+
+/*
+ * The exact training counts of one row. Counters start a byte wide and
+ * are widened to 2, 4 and then 8 bytes as they fill, so a lightly trained
+ * row takes a quarter of the space of 32 bit counters and a heavily
+ * trained one never wraps. Widening makes a new row: its owner allocates
+ * STOCH_CROW_SIZE( shift ) bytes, copies the counts over with
+ * stoch_crow_widen and retires the old row.
+ */
+struct _stoch_crow {
+	u64 total;
+	unsigned int shift; // counters are 1 << shift bytes
+	unsigned int base; // epoch the counts are weighed from, see stoch_crow_rebase
+	u64 bins[]; // STOCH_HIST_SIZE counters
+};
+
+#define STOCH_CROW_SIZE( shift ) (sizeof(struct _stoch_crow) + (STOCH_HIST_SIZE << (shift)))
+
+static inline u64 stoch_crow_get( const struct _stoch_crow *r, unsigned int i ) {
+	switch (r->shift) {
+	case 0:
+		return READ_ONCE( ((const u8 *)r->bins)[i] );
+	case 1:
+		return READ_ONCE( ((const u16 *)r->bins)[i] );
+	case 2:
+		return READ_ONCE( ((const u32 *)r->bins)[i] );
+	default:
+		return READ_ONCE( r->bins[i] );
+	}
+}
+
+// the shift r (NULL for a row with no counts yet) needs to take d << scale as well
+unsigned int stoch_crow_fit( const struct _stoch_crow *r, const u16 *d, unsigned int scale );
+
+// set up dst with the given shift and the counts and base of src, NULL for none
+void stoch_crow_widen( struct _stoch_crow *dst, unsigned int shift, const struct _stoch_crow *src );
+
+/*
+ * Add d << scale into r, zeroing what was added. Stops with -EOVERFLOW at
+ * the first counter that does not fit, so the caller can widen the row to
+ * what stoch_crow_fit says and add the rest.
+ */
+int stoch_crow_add( struct _stoch_crow *r, u16 *d, unsigned int scale );
+
+/*
+ * Decaying counts. Rather than every count being halved each epoch, a
+ * count added in epoch e is weighed 1 << (e - base), so moving on to the
+ * next epoch touches nothing. Only the ratios within a row matter for
+ * sampling it; rows are compared through their bases. Before the weights
+ * outgrow the counters a row is rebased: its counts are shifted down to a
+ * newer base, and the ones that have decayed to nothing are forgotten.
+ */
+#define STOCH_DECAY_SPAN 16 // most epochs a row runs ahead of its base
+
+void stoch_crow_rebase( struct _stoch_crow *r, unsigned int base );
+
+// drop every count of r and start again from base
+void stoch_crow_reset( struct _stoch_crow *r, unsigned int base );
+
+/*
+ * Set h from 64 bit counts. If their total does not fit the 32 bits the
+ * sampling tables use, they are all scaled down by the same power of two,
+ * keeping every count that was not zero at one or more.
+ */
+void stoch_hist_set( struct _stoch_hist *h, const u64 *counts );
+
+/* ------- training --------------- */
+
+#define STOCH_SUBHISTS 4 // interleaved sub-histograms used for bulk counting
+#define STOCH_COUNT_BLOCK 0xfff0 // bytes counted between folds
+
+/*
+ * Scratch space for counting training data a block at a time. Successive
+ * bytes are counted into different sub-histograms, so a run of the same
+ * byte is not a chain of dependent increments on one counter; at order 1
+ * the lanes count contexts and the pairs go straight into rows. A block
+ * is at most STOCH_COUNT_BLOCK bytes, so no 16 bit counter can overflow,
+ * and folding the touched rows into the model with stoch_crow_add leaves
+ * everything zeroed for the next one. Order 0 only counts into row 0, so
+ * its scratch is allocated with the one row, STOCH_COUNT_SIZE( 1 ) bytes.
+ */
+struct _stoch_count {
+	u16 sub[STOCH_SUBHISTS][STOCH_HIST_SIZE];
+	u16 rows[][STOCH_HIST_SIZE];
+};
+
+#define STOCH_COUNT_SIZE( nrows ) (sizeof(struct _stoch_count) + (nrows) * STOCH_HIST_SIZE * sizeof(u16))
+
+/*
+ * Count a block of training data into cnt->rows starting from context
+ * prev. mask is 0 for order 0, where everything goes into row 0, or
+ * STOCH_HIST_SIZE - 1 for order 1, where the row for each byte is the byte
+ * before it. The rows counted into are set in the touched bitmap. Returns
+ * the context of the next byte.
+ */
+u64 stoch_hist_count( struct _stoch_count *cnt, unsigned int mask, u64 prev,
+		      const unsigned char *buff, size_t size, unsigned long *touched );
+
+#endif
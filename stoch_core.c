@@ -0,0 +1,1423 @@
+/*
+ * Histogram, sampling and training core, see stoch.h. Built into the
+ * module and into libstoch.a, so it must only use what stoch_plat.h
+ * provides.
+ */
+
+#include "stoch.h"
+
+/* ------- samplers --------------- */
+
+const char *const stoch_sampler_names[STOCH_SAMPLER_COUNT] = {
+	"scan",
+	"alias",
+	"cdf",
+	"fenwick"
+};
+
+int stoch_sampler_parse( const char *name ) {
+	int i;
+
+	for (i = 0; i < STOCH_SAMPLER_COUNT; i++) {
+		if (strcmp( name, stoch_sampler_names[i] ) == 0) {
+			return i;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* ------- modes --------------- */
+
+const char *const stoch_mode_names[STOCH_MODE_COUNT] = {
+	"accumulate",
+	"decay",
+	"window"
+};
+
+int stoch_mode_parse( const char *name ) {
+	int i;
+
+	for (i = 0; i < STOCH_MODE_COUNT; i++) {
+		if (strcmp( name, stoch_mode_names[i] ) == 0) {
+			return i;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* ------- rng --------------- */
+
+const char *const stoch_rng_names[STOCH_RNG_COUNT] = {
+	"crypto",
+	"fast"
+};
+
+int stoch_rng_parse( const char *name ) {
+	int i;
+
+	for (i = 0; i < STOCH_RNG_COUNT; i++) {
+		if (strcmp( name, stoch_rng_names[i] ) == 0) {
+			return i;
+		}
+	}
+
+	return -EINVAL;
+}
+
+void stoch_rng_init( struct _stoch_rng *r, int mode ) {
+	r->mode = mode;
+	r->pos = STOCH_RNG_BATCH;
+	r->count = 0;
+	if (mode == STOCH_RNG_FAST) {
+		stoch_plat_seed( r->s );
+	}
+}
+
+void stoch_rng_refill( struct _stoch_rng *r ) {
+	int i;
+
+	if (r->mode == STOCH_RNG_CRYPTO) {
+		stoch_plat_random( r->buf, sizeof(r->buf) );
+	} else {
+		if (r->count >= STOCH_RNG_RESEED) {
+			stoch_plat_seed( r->s );
+			r->count = 0;
+		}
+		for (i = 0; i < STOCH_RNG_BATCH; i++) {
+			r->buf[i] = stoch_xoshiro_next( r->s );
+		}
+		r->count += STOCH_RNG_BATCH;
+	}
+	r->pos = 0;
+}
+
+/* ------- alias table --------------- */
+
+void stoch_alias_build( struct _stoch_alias *a, const struct _stoch_hist *h, u64 *w ) {
+	unsigned char small[STOCH_HIST_SIZE], large[STOCH_HIST_SIZE];
+	int i, ns, nl;
+	unsigned int l, g;
+	u64 total;
+
+	total = h->total;
+	a->total = h->total;
+
+	ns = 0;
+	nl = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		w[i] = (u64)h->data[i] * STOCH_HIST_SIZE;
+		if (w[i] < total) {
+			small[ns++] = i;
+		} else {
+			large[nl++] = i;
+		}
+	}
+
+	// pair each underfull bin with an overfull one which donates the remainder
+	while (ns > 0 && nl > 0) {
+		l = small[--ns];
+		g = large[--nl];
+
+		a->prob[l] = (unsigned int)w[l];
+		a->alias[l] = g;
+
+		w[g] -= total - w[l];
+		if (w[g] < total) {
+			small[ns++] = g;
+		} else {
+			large[nl++] = g;
+		}
+	}
+
+	// whatever is left is exactly full
+	while (nl > 0) {
+		g = large[--nl];
+		a->prob[g] = a->total;
+		a->alias[g] = g;
+	}
+	while (ns > 0) {
+		l = small[--ns];
+		a->prob[l] = a->total;
+		a->alias[l] = l;
+	}
+}
+
+// round to nearest, but keep a bin that can be kept at all reachable
+static inline u16 stoch_qalias_prob( u64 prob, u64 total ) {
+	unsigned int p;
+
+	p = (unsigned int)(((prob << 16) + total / 2) / total);
+	if (p == 0 && prob != 0) {
+		p = 1;
+	}
+	return min_t( unsigned int, p, 0xffff );
+}
+
+void stoch_qalias_build( struct _stoch_qalias *q, const struct _stoch_alias *a ) {
+	unsigned int i;
+
+	if (a->total == 0) {
+		memset( q, 0, sizeof(*q) );
+		return;
+	}
+
+	q->total = a->total;
+	q->dense = 1;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		q->bins.prob[i] = stoch_qalias_prob( a->prob[i], a->total );
+		q->bins.alias[i] = a->alias[i];
+	}
+}
+
+/* ------- cdf --------------- */
+
+void stoch_cdf_build( struct _stoch_cdf *c, const struct _stoch_hist *h ) {
+	unsigned int tot;
+	int i;
+
+	tot = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		tot += h->data[i];
+		c->cdf[i] = tot;
+		if (i % STOCH_CDF_LINE == STOCH_CDF_LINE - 1) {
+			c->top[i / STOCH_CDF_LINE] = tot;
+		}
+	}
+}
+
+/* ------- frequency order --------------- */
+
+void stoch_order_build( struct _stoch_order *o, const struct _stoch_hist *h, const struct _stoch_order *hint ) {
+	unsigned char seed[STOCH_HIST_SIZE];
+	unsigned int i, j, used, nempty, c;
+	unsigned char b;
+
+	// a hint that never saw any data (e.g. the zeroed empty row) is no help
+	if (hint && hint->used) {
+		memcpy( seed, hint->bin, sizeof(seed) );
+	} else {
+		for (i = 0; i < STOCH_HIST_SIZE; i++) {
+			seed[i] = i;
+		}
+	}
+
+	// keep the seed order but move the empty bins to the back
+	used = 0;
+	nempty = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		b = seed[i];
+		if (h->data[b]) {
+			o->bin[used++] = b;
+		} else {
+			seed[nempty++] = b;
+		}
+	}
+	memcpy( o->bin + used, seed, nempty );
+	o->used = used;
+
+	// insertion sort the used bins by descending count
+	for (i = 1; i < used; i++) {
+		b = o->bin[i];
+		c = h->data[b];
+		for (j = i; j > 0 && h->data[o->bin[j - 1]] < c; j--) {
+			o->bin[j] = o->bin[j - 1];
+		}
+		o->bin[j] = b;
+	}
+}
+
+/* ------- fenwick --------------- */
+
+// turn nodes holding one bin each into the tree, each node passing its sum on to its parent
+static void stoch_fenwick_sum( struct _stoch_fenwick *f ) {
+	unsigned int i, j;
+
+	for (i = 1; i <= STOCH_HIST_SIZE; i++) {
+		j = i + (i & -i);
+		if (j <= STOCH_HIST_SIZE) {
+			f->node[j - 1] += f->node[i - 1];
+		}
+	}
+}
+
+void stoch_fenwick_build( struct _stoch_fenwick *f, const struct _stoch_hist *h ) {
+	unsigned int i;
+
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		f->node[i] = h->data[i];
+	}
+	stoch_fenwick_sum( f );
+}
+
+void stoch_fenwick_halve( struct _stoch_fenwick *f ) {
+	unsigned int i, j;
+
+	// undo stoch_fenwick_sum, parents first, leaving the bins
+	for (i = STOCH_HIST_SIZE; i > 0; i--) {
+		j = i + (i & -i);
+		if (j <= STOCH_HIST_SIZE) {
+			f->node[j - 1] -= f->node[i - 1];
+		}
+	}
+	// rounding up, so no bin that was counted is forgotten
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		f->node[i] -= f->node[i] / 2;
+	}
+	stoch_fenwick_sum( f );
+}
+
+unsigned char stoch_fenwick_val( const struct _stoch_fenwick *f, struct _stoch_rng *rng ) {
+	unsigned int total, u, v, pos, step;
+
+	total = stoch_fenwick_total( f );
+	if (total == 0) {
+		return 0;
+	}
+
+	// find how many bins lie wholly below the draw, that count is the value
+	u = (unsigned int)(((stoch_rng_next( rng ) >> 32) * total) >> 32);
+	pos = 0;
+	for (step = STOCH_HIST_SIZE / 2; step > 0; step >>= 1) {
+		v = READ_ONCE( f->node[pos + step - 1] );
+		if (v <= u) {
+			u -= v;
+			pos += step;
+		}
+	}
+
+	return pos;
+}
+
+u64 stoch_fenwick_count( struct _stoch_fenwick *rows, struct _stoch_fenwick *start, unsigned int mask, u64 prev,
+			 const unsigned char *buff, size_t size ) {
+	unsigned int row;
+	size_t i;
+
+	if (size == 0) {
+		return prev;
+	}
+
+	row = prev & mask;
+	for (i = 0; i < size; i++) {
+		if (stoch_fenwick_total( &rows[row] ) == STOCH_FENWICK_MAX) {
+			stoch_fenwick_halve( &rows[row] );
+		}
+		if (stoch_fenwick_total( start ) == STOCH_FENWICK_MAX) {
+			stoch_fenwick_halve( start );
+		}
+		stoch_fenwick_add( &rows[row], buff[i], 1 );
+		stoch_fenwick_add( start, row, 1 );
+		row = buff[i] & mask;
+	}
+
+	return buff[size - 1];
+}
+
+/* ------- sparse rows --------------- */
+
+// how many bins of h are not empty, or STOCH_HIST_SIZE if more than a sparse row holds
+static unsigned int stoch_sparse_used( const struct _stoch_hist *h ) {
+	unsigned int i, n;
+
+	n = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		if (h->data[i] && ++n > STOCH_SPARSE_MAX) {
+			return STOCH_HIST_SIZE;
+		}
+	}
+
+	return n;
+}
+
+// stoch_alias_build and stoch_qalias_build at once, over a slot for each of the n values of h
+static void stoch_sparse_build( struct _stoch_qalias *q, const struct _stoch_hist *h, unsigned int n ) {
+	unsigned char small[STOCH_SPARSE_MAX], large[STOCH_SPARSE_MAX];
+	u64 w[STOCH_SPARSE_MAX], total;
+	unsigned int i, k, l, g;
+	int ns, nl;
+
+	memset( q, 0, offsetof( struct _stoch_qalias, vals ) + sizeof(q->vals) );
+	q->total = h->total;
+	total = h->total;
+	if (n == 0) {
+		return;
+	}
+
+	k = 0;
+	for (i = 0; i < STOCH_HIST_SIZE && k < n; i++) {
+		if (h->data[i]) {
+			q->vals.val[k++] = i;
+		}
+	}
+
+	// slots past the n values weigh nothing, so they are never kept
+	ns = 0;
+	nl = 0;
+	for (k = 0; k < STOCH_SPARSE_MAX; k++) {
+		w[k] = (k < n) ? (u64)h->data[q->vals.val[k]] * STOCH_SPARSE_MAX : 0;
+		if (w[k] < total) {
+			small[ns++] = k;
+		} else {
+			large[nl++] = k;
+		}
+	}
+
+	// w[l] is final once l is paired, so it is quantized straight away
+	while (ns > 0 && nl > 0) {
+		l = small[--ns];
+		g = large[--nl];
+
+		q->vals.prob[l] = stoch_qalias_prob( w[l], total );
+		q->vals.alias[l] = q->vals.val[g];
+
+		w[g] -= total - w[l];
+		if (w[g] < total) {
+			small[ns++] = g;
+		} else {
+			large[nl++] = g;
+		}
+	}
+	while (nl > 0) {
+		g = large[--nl];
+		q->vals.prob[g] = 0xffff;
+		q->vals.alias[g] = q->vals.val[g];
+	}
+	while (ns > 0) {
+		l = small[--ns];
+		q->vals.prob[l] = 0xffff;
+		q->vals.alias[l] = q->vals.val[l];
+	}
+}
+
+/* ------- distributions --------------- */
+
+size_t stoch_dist_size( const struct _stoch_hist *h, int sampler ) {
+	unsigned int n;
+
+	n = stoch_sparse_used( h );
+	if (n < STOCH_HIST_SIZE) {
+		return offsetof( struct _stoch_dist, qalias.vals.alias[STOCH_SPARSE_MAX] );
+	}
+	switch (sampler) {
+	case STOCH_SAMPLER_CDF:
+		return offsetof( struct _stoch_dist, cdf ) + sizeof(struct _stoch_cdf);
+	case STOCH_SAMPLER_SCAN:
+		return offsetof( struct _stoch_dist, hist ) + sizeof(struct _stoch_hist);
+	}
+	return sizeof(struct _stoch_qalias);
+}
+
+void stoch_dist_build( struct _stoch_dist *d, const struct _stoch_dist *prev, struct _stoch_hist *h, int sampler,
+		       struct _stoch_build *b ) {
+	const struct _stoch_order *hint;
+	unsigned int total, n;
+	int i;
+
+	// recompute the total from the bins so the two always agree
+	total = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		total += h->data[i];
+	}
+	h->total = total;
+
+	// the exact alias table is always built since it also feeds the mmap copy
+	stoch_alias_build( &b->alias, h, b->w );
+
+	// only scan keeps the histogram, the other tables are built over it
+	if (h == &d->hist && sampler != STOCH_SAMPLER_SCAN) {
+		memcpy( &b->hist, h, sizeof(*h) );
+		h = &b->hist;
+	}
+
+	n = stoch_sparse_used( h );
+	if (n < STOCH_HIST_SIZE) {
+		stoch_sparse_build( &d->qalias, h, n );
+		return;
+	}
+
+	switch (sampler) {
+	case STOCH_SAMPLER_CDF:
+		stoch_cdf_build( &d->cdf, h );
+		break;
+	case STOCH_SAMPLER_SCAN:
+		// only a dense row has an order to start from, prev may be d itself
+		hint = (prev && prev->qalias.dense) ? &prev->order : NULL;
+		if (h != &d->hist) {
+			memcpy( &d->hist, h, sizeof(*h) );
+		}
+		stoch_order_build( &d->order, &d->hist, hint );
+		break;
+	default:
+		stoch_qalias_build( &d->qalias, &b->alias );
+		return;
+	}
+	d->qalias.total = total;
+	d->qalias.dense = 1;
+}
+
+unsigned char stoch_dist_val( int sampler, const struct _stoch_dist *d, struct _stoch_rng *rng ) {
+	unsigned int j, p, tot, k;
+	unsigned char val;
+
+	// a sparse row has nothing else to draw from, whichever sampler was asked for
+	if (sampler == STOCH_SAMPLER_ALIAS || !d->qalias.dense) {
+		return stoch_qalias_val( &d->qalias, rng );
+	}
+	if (sampler == STOCH_SAMPLER_CDF) {
+		return stoch_cdf_val( &d->cdf, rng );
+	}
+
+	// if no data has been written to the histogram then just return 0
+	if (d->hist.total == 0) {
+		return 0;
+	}
+
+	// walk the bins most frequent first, skipping the empty ones
+	j = (unsigned int)stoch_rng_next( rng );
+	p = j % d->hist.total;
+	tot = 0;
+	val = 0;
+	for (k = 0; k < d->order.used; k++) {
+		val = d->order.bin[k];
+		tot += d->hist.data[val];
+		if (tot > p) {
+			// found the bin, break out and return
+			break;
+		}
+	}
+
+	return val;
+}
+
+// the synthetic distributions cover 1-255 so a chain through them never ends
+void stoch_hist_synth( struct _stoch_hist *h, int dist ) {
+	int i;
+
+	memset( h, 0, sizeof(*h) );
+	for (i = 1; i < STOCH_HIST_SIZE; i++) {
+		switch (dist) {
+		case STOCH_BENCH_UNIFORM:
+			h->data[i] = 1024;
+			break;
+		case STOCH_BENCH_ZIPF:
+			h->data[i] = (1 << 20) / i;
+			break;
+		case STOCH_BENCH_SINGLE:
+			h->data[i] = (i == 'a') ? 1024 : 0;
+			break;
+		}
+		h->total += h->data[i];
+	}
+}
+
+/* ------- chains --------------- */
+
+void stoch_chain_start( struct _stoch_chain *c, const struct _stoch_dist *start ) {
+	// bins past the last row are empty so the alias table never returns them
+	c->ctx = stoch_qalias_val( &start->qalias, &c->rng );
+
+	// with nothing trained yet the chain ends immediately
+	c->started = (start->qalias.total != 0);
+}
+
+size_t stoch_chain_gen( struct _stoch_chain *c, int sampler, struct _stoch_dist __rcu *const *rows,
+			unsigned int mask, unsigned char *buff, size_t size ) {
+	size_t i;
+	unsigned char prev;
+
+	prev = (unsigned char)c->ctx;
+	for (i = 0; i < size; i++) {
+		buff[i] = stoch_dist_val( sampler, stoch_deref( rows[prev & mask] ), &c->rng );
+		prev = buff[i];
+		if (buff[i] == 0) {
+			// the chain has ended, the next call starts a new one
+			c->started = 0;
+			break;
+		}
+	}
+	c->ctx = prev;
+
+	return i;
+}
+
+/* ------- contexts --------------- */
+
+static inline unsigned int stoch_ctx_hash( u64 ctx, unsigned int mask ) {
+	return (unsigned int)(((u64)hash_64( ctx, 32 ) * ((u64)mask + 1)) >> 32);
+}
+
+static struct _stoch_ctab *stoch_ctab_alloc( unsigned int size ) {
+	struct _stoch_ctab *t;
+
+	t = stoch_plat_zalloc( sizeof(*t) + size * sizeof(t->slots[0]) + size / STOCH_CTAB_BLOCK * sizeof(t->sums[0]) );
+	if (t) {
+		t->mask = size - 1;
+		t->sums = (u64 *)&t->slots[size];
+	}
+	return t;
+}
+
+// add d, which may be negative, to the sum of the block holding slot i
+static void stoch_ctab_sum( struct _stoch_ctab *t, unsigned int i, u64 d ) {
+	unsigned int nblocks = (t->mask + 1) / STOCH_CTAB_BLOCK;
+
+	for (i = i / STOCH_CTAB_BLOCK + 1; i <= nblocks; i += i & -i) {
+		WRITE_ONCE( t->sums[i - 1], t->sums[i - 1] + d );
+	}
+}
+
+// slot holding ctx, or the empty slot where it would go
+static unsigned int stoch_ctab_slot( struct _stoch_ctab *t, u64 ctx ) {
+	struct _stoch_srow *r;
+	unsigned int i;
+
+	for (i = stoch_ctx_hash( ctx, t->mask ); ; i = (i + 1) & t->mask) {
+		r = stoch_deref_writer( t->slots[i] );
+		if (!r || r->ctx == ctx) {
+			return i;
+		}
+	}
+}
+
+// the row of ctx, NULL if it was never seen
+static const struct _stoch_srow *stoch_ctab_find( const struct _stoch_ctab *t, u64 ctx ) {
+	const struct _stoch_srow *r;
+	unsigned int i;
+
+	for (i = stoch_ctx_hash( ctx, t->mask ); ; i = (i + 1) & t->mask) {
+		r = stoch_deref( t->slots[i] );
+		if (!r || r->ctx == ctx) {
+			return r;
+		}
+	}
+}
+
+// double the table; the rows move over as they are
+static struct _stoch_ctab *stoch_ctab_grow( struct _stoch_ctxs *x, struct _stoch_ctab *t ) {
+	struct _stoch_ctab *nt;
+	struct _stoch_srow *r;
+	unsigned int i, j, nblocks;
+
+	nt = stoch_ctab_alloc( (t->mask + 1) * 2 );
+	if (!nt) {
+		return NULL;
+	}
+
+	for (i = 0; i <= t->mask; i++) {
+		r = stoch_deref_writer( t->slots[i] );
+		if (r) {
+			j = stoch_ctab_slot( nt, r->ctx );
+			stoch_publish( nt->slots[j], r );
+			nt->sums[j / STOCH_CTAB_BLOCK] += r->total;
+		}
+	}
+	// each block's node passes its sum on to its parent, as stoch_fenwick_sum does
+	nblocks = (nt->mask + 1) / STOCH_CTAB_BLOCK;
+	for (i = 1; i <= nblocks; i++) {
+		j = i + (i & -i);
+		if (j <= nblocks) {
+			nt->sums[j - 1] += nt->sums[i - 1];
+		}
+	}
+	nt->used = t->used;
+	nt->total = t->total;
+
+	stoch_publish( x->ctab, nt );
+	stoch_retire( t );
+
+	return nt;
+}
+
+// the count in bin x of a tree, the difference of the sums of the bins before x + 1 and before x
+static unsigned int stoch_fenwick_bin( const struct _stoch_fenwick *f, unsigned int x ) {
+	unsigned int i, s;
+
+	s = 0;
+	for (i = x + 1; i > 0; i -= i & -i) {
+		s += f->node[i - 1];
+	}
+	for (i = x; i > 0; i -= i & -i) {
+		s -= f->node[i - 1];
+	}
+	return s;
+}
+
+// halve the counts of row r in slot i of t, rounding up so none drops to 0, lowering the sums first
+static void stoch_srow_halve( struct _stoch_ctab *t, unsigned int i, struct _stoch_srow *r ) {
+	unsigned int j, c, total;
+
+	total = 0;
+	if (r->tree) {
+		for (j = 0; j < STOCH_HIST_SIZE; j++) {
+			c = stoch_fenwick_bin( r->tree, j );
+			total += c - c / 2;
+		}
+	} else {
+		for (j = 0; j < r->n; j++) {
+			total += r->e[j].count - r->e[j].count / 2;
+		}
+	}
+	WRITE_ONCE( t->total, t->total - (r->total - total) );
+	smp_wmb();
+	stoch_ctab_sum( t, i, -(u64)(r->total - total) );
+	smp_wmb();
+	WRITE_ONCE( r->total, total );
+	smp_wmb();
+	if (r->tree) {
+		stoch_fenwick_halve( r->tree );
+	} else {
+		for (j = 0; j < r->n; j++) {
+			WRITE_ONCE( r->e[j].count, r->e[j].count - r->e[j].count / 2 );
+		}
+	}
+}
+
+// replace row r in slot i of t by a tree holding the same counts
+static struct _stoch_srow *stoch_srow_tree( struct _stoch_ctab *t, unsigned int i, struct _stoch_srow *r ) {
+	struct _stoch_srow *nr;
+	unsigned int j;
+
+	nr = stoch_plat_zalloc( sizeof(*nr) );
+	if (!nr) {
+		return NULL;
+	}
+	nr->tree = stoch_plat_zalloc( sizeof(*nr->tree) );
+	if (!nr->tree) {
+		stoch_plat_free( nr );
+		return NULL;
+	}
+	nr->ctx = r->ctx;
+	nr->total = r->total;
+	for (j = 0; j < r->n; j++) {
+		stoch_fenwick_add( nr->tree, r->e[j].sym, r->e[j].count );
+	}
+	stoch_publish( t->slots[i], nr );
+	stoch_retire( r );
+
+	return nr;
+}
+
+static inline unsigned int stoch_pair_hash( u64 ctx, unsigned char sym, unsigned int mask ) {
+	return stoch_ctx_hash( (ctx << 8 | sym) ^ (ctx >> 56), mask );
+}
+
+/*
+ * Empty the indexes of b for another batch. A small batch forgets its
+ * entries last to first, each then being the end of the probe run that
+ * finds it, rather than clearing the whole of both.
+ */
+static void stoch_cbatch_clear( struct _stoch_cbatch *b ) {
+	unsigned int h, l;
+
+	if (b->npairs > STOCH_CBATCH_PAIRS / 16) {
+		memset( b->cindex, 0, sizeof(b->cindex) );
+		memset( b->pindex, 0, sizeof(b->pindex) );
+	} else {
+		for (l = b->npairs; l-- > 0; ) {
+			for (h = stoch_pair_hash( b->p[l].ctx, b->p[l].sym, ARRAY_SIZE( b->pindex ) - 1 ); b->pindex[h] != l + 1;
+			     h = (h + 1) & (ARRAY_SIZE( b->pindex ) - 1))
+				;
+			b->pindex[h] = 0;
+		}
+		for (l = b->nctxs; l-- > 0; ) {
+			for (h = stoch_ctx_hash( b->c[l].ctx, ARRAY_SIZE( b->cindex ) - 1 ); b->cindex[h] != l + 1;
+			     h = (h + 1) & (ARRAY_SIZE( b->cindex ) - 1))
+				;
+			b->cindex[h] = 0;
+		}
+	}
+	b->nctxs = 0;
+	b->npairs = 0;
+}
+
+// the entry of ctx in b, finding or making its row for a new one; -ENOSPC if b is full, -ENOMEM
+static int stoch_cbatch_ctx( struct _stoch_ctxs *x, struct _stoch_cbatch *b, u64 ctx ) {
+	struct _stoch_ctab *t;
+	struct _stoch_srow *r;
+	unsigned int h, i, k;
+
+	for (h = stoch_ctx_hash( ctx, ARRAY_SIZE( b->cindex ) - 1 ); b->cindex[h]; h = (h + 1) & (ARRAY_SIZE( b->cindex ) - 1)) {
+		if (b->c[b->cindex[h] - 1].ctx == ctx) {
+			return b->cindex[h] - 1;
+		}
+	}
+	if (b->nctxs == STOCH_CBATCH_CTXS) {
+		return -ENOSPC;
+	}
+
+	t = stoch_deref_writer( x->ctab );
+	i = stoch_ctab_slot( t, ctx );
+	r = stoch_deref_writer( t->slots[i] );
+
+	if (!r) {
+		// new context, keep the table at most 3/4 full
+		if ((t->used + 1) * 4 > (t->mask + 1) * 3) {
+			t = stoch_ctab_grow( x, t );
+			if (!t) {
+				return -ENOMEM;
+			}
+			i = stoch_ctab_slot( t, ctx );
+		}
+
+		r = stoch_plat_zalloc( sizeof(*r) + STOCH_SROW_MIN * sizeof(r->e[0]) );
+		if (!r) {
+			return -ENOMEM;
+		}
+		r->ctx = ctx;
+		r->cap = STOCH_SROW_MIN;
+		stoch_publish( t->slots[i], r );
+		t->used++;
+	}
+
+	k = b->nctxs++;
+	b->cindex[h] = k + 1;
+	b->c[k].ctx = ctx;
+	b->c[k].row = r;
+	b->c[k].slot = i;
+	b->c[k].fresh = 0;
+	b->c[k].add = 0;
+
+	return k;
+}
+
+// whether sparse row r has seen successor sym
+static int stoch_srow_has( const struct _stoch_srow *r, unsigned char sym ) {
+	unsigned int j;
+
+	for (j = 0; j < r->n; j++) {
+		if (r->e[j].sym == sym) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Make room in the row of context k of b for successor sym of a new pair,
+ * replacing the row if need be. While the row has room whether or not sym
+ * is new it is not looked for, so fresh may count some the row has; it is
+ * counted exactly before the row is replaced for want of room.
+ */
+static int stoch_cbatch_room( struct _stoch_ctxs *x, struct _stoch_cbatch *b, unsigned int k, unsigned char sym ) {
+	struct _stoch_ctab *t;
+	struct _stoch_srow *r, *nr;
+	unsigned int i, l, fresh, cap;
+
+	r = b->c[k].row;
+	if (r->tree) {
+		return 0;
+	}
+	if (r->n + b->c[k].fresh < r->cap) {
+		b->c[k].fresh++;
+		return 0;
+	}
+	if (stoch_srow_has( r, sym )) {
+		return 0;
+	}
+
+	fresh = 1;
+	for (l = 0; l < b->npairs; l++) {
+		if (b->p[l].c == k && !stoch_srow_has( r, b->p[l].sym )) {
+			fresh++;
+		}
+	}
+	b->c[k].fresh = fresh;
+	if (r->n + fresh <= r->cap) {
+		return 0;
+	}
+
+	t = stoch_deref_writer( x->ctab );
+	i = stoch_ctab_slot( t, r->ctx );
+	if (r->cap == STOCH_SROW_MAX) {
+		nr = stoch_srow_tree( t, i, r );
+		if (!nr) {
+			return -ENOMEM;
+		}
+	} else {
+		cap = 2 * r->cap;
+		nr = stoch_plat_zalloc( sizeof(*nr) + cap * sizeof(nr->e[0]) );
+		if (!nr) {
+			return -ENOMEM;
+		}
+		memcpy( nr, r, sizeof(*r) + r->n * sizeof(r->e[0]) );
+		nr->cap = cap;
+		stoch_publish( t->slots[i], nr );
+		stoch_retire( r );
+	}
+	b->c[k].row = nr;
+
+	return 0;
+}
+
+/*
+ * Gather bytes of buff, the first counted after ctx, into b until it has
+ * no room for another context or pair, finding or making the row of each
+ * context and making room in it for each successor as they come. Returns
+ * how many were, 0 only if there was no memory for the first.
+ */
+static size_t stoch_cbatch_fill( struct _stoch_ctxs *x, struct _stoch_cbatch *b, u64 ctx,
+				 const unsigned char *buff, size_t size ) {
+	struct _stoch_ctab *t;
+	unsigned int h, l;
+	u64 ahead;
+	int k;
+	size_t i;
+
+	stoch_cbatch_clear( b );
+	size = min_t( size_t, size, STOCH_CBATCH_BYTES );
+	ahead = ctx;
+	for (i = 0; i < STOCH_CBATCH_AHEAD && i < size; i++) {
+		ahead = ((ahead << 8) | buff[i]) & x->mask;
+	}
+	for (i = 0; i < size; i++) {
+		// the slot of the context STOCH_CBATCH_AHEAD bytes on is on its way in by the time it is needed
+		if (i + STOCH_CBATCH_AHEAD < size) {
+			t = stoch_deref_writer( x->ctab );
+			prefetch( &t->slots[stoch_ctx_hash( ahead, t->mask )] );
+			ahead = ((ahead << 8) | buff[i + STOCH_CBATCH_AHEAD]) & x->mask;
+		}
+
+		for (h = stoch_pair_hash( ctx, buff[i], ARRAY_SIZE( b->pindex ) - 1 ); b->pindex[h];
+		     h = (h + 1) & (ARRAY_SIZE( b->pindex ) - 1)) {
+			l = b->pindex[h] - 1;
+			if (b->p[l].ctx == ctx && b->p[l].sym == buff[i]) {
+				break;
+			}
+		}
+		if (!b->pindex[h]) {
+			if (b->npairs == STOCH_CBATCH_PAIRS) {
+				break;
+			}
+			k = stoch_cbatch_ctx( x, b, ctx );
+			if (k < 0 || stoch_cbatch_room( x, b, k, buff[i] ) < 0) {
+				break;
+			}
+			l = b->npairs++;
+			b->pindex[h] = l + 1;
+			b->p[l].ctx = ctx;
+			b->p[l].count = 0;
+			b->p[l].c = k;
+			b->p[l].sym = buff[i];
+		}
+		b->p[l].count++;
+
+		ctx = ((ctx << 8) | buff[i]) & x->mask;
+	}
+	b->ctx = ctx;
+
+	return i;
+}
+
+// add n to successor sym of sparse row r, which has room for it if new, moving it up past any it now outnumbers
+static void stoch_srow_add( struct _stoch_srow *r, unsigned char sym, unsigned int n ) {
+	unsigned int j, c;
+
+	for (j = 0; j < r->n && r->e[j].sym != sym; j++)
+		;
+	if (j == r->n) {
+		// a new successor goes last, with no count yet
+		r->e[j].sym = sym;
+		r->e[j].count = 0;
+		smp_wmb();
+		WRITE_ONCE( r->n, j + 1 );
+	}
+	c = r->e[j].count + n;
+	for (; j > 0 && r->e[j - 1].count < c; j--) {
+		WRITE_ONCE( r->e[j].count, r->e[j - 1].count );
+		WRITE_ONCE( r->e[j].sym, r->e[j - 1].sym );
+	}
+	WRITE_ONCE( r->e[j].sym, sym );
+	WRITE_ONCE( r->e[j].count, c );
+}
+
+// write the pairs gathered in b into the rows of their contexts, then the rows' totals into the sums
+static void stoch_cbatch_count( struct _stoch_ctab *t, struct _stoch_cbatch *b ) {
+	struct _stoch_srow *r;
+	unsigned int k, l;
+
+	for (l = 0; l < b->npairs; l++) {
+		b->c[b->p[l].c].add += b->p[l].count;
+	}
+	for (k = 0; k < b->nctxs; k++) {
+		r = b->c[k].row;
+		if (r->total > UINT_MAX - b->c[k].add) {
+			stoch_srow_halve( t, b->c[k].slot, r );
+		}
+	}
+
+	for (l = 0; l < b->npairs; l++) {
+		r = b->c[b->p[l].c].row;
+		if (r->tree) {
+			stoch_fenwick_add( r->tree, b->p[l].sym, b->p[l].count );
+		} else {
+			stoch_srow_add( r, b->p[l].sym, b->p[l].count );
+		}
+	}
+
+	smp_wmb();
+	for (k = 0; k < b->nctxs; k++) {
+		r = b->c[k].row;
+		WRITE_ONCE( r->total, r->total + b->c[k].add );
+	}
+	smp_wmb();
+	for (k = 0; k < b->nctxs; k++) {
+		stoch_ctab_sum( t, b->c[k].slot, b->c[k].add );
+	}
+}
+
+ssize_t stoch_ctxs_train( struct _stoch_ctxs *x, u64 *ctx, const unsigned char *buff, size_t size ) {
+	struct _stoch_cbatch *b = x->batch;
+	struct _stoch_ctab *t;
+	unsigned int k;
+	size_t i, n;
+
+	for (i = 0; i < size; i += n) {
+		t = stoch_deref_writer( x->ctab );
+		n = stoch_cbatch_fill( x, b, *ctx, buff + i, size - i );
+		if (n == 0) {
+			break;
+		}
+
+		if (stoch_deref_writer( x->ctab ) != t) {
+			// the table grew under the slots found, the rows moved over as they were
+			t = stoch_deref_writer( x->ctab );
+			for (k = 0; k < b->nctxs; k++) {
+				b->c[k].slot = stoch_ctab_slot( t, b->c[k].ctx );
+			}
+		}
+
+		stoch_cbatch_count( t, b );
+		smp_wmb();
+		WRITE_ONCE( t->total, t->total + n );
+		*ctx = b->ctx;
+	}
+
+	return (i == 0 && size > 0) ? -ENOMEM : (ssize_t)i;
+}
+
+// draw a successor from a row, 0 if the context was never seen
+static unsigned char stoch_srow_val( const struct _stoch_srow *r, struct _stoch_rng *rng ) {
+	unsigned int total, n, p, tot, j;
+
+	if (!r) {
+		return 0;
+	}
+	if (r->tree) {
+		return stoch_fenwick_val( r->tree, rng );
+	}
+
+	total = READ_ONCE( r->total );
+	smp_rmb();
+	n = READ_ONCE( r->n );
+	smp_rmb();
+	if (total == 0) {
+		return 0;
+	}
+
+	p = (unsigned int)(((stoch_rng_next( rng ) >> 32) * total) >> 32);
+	tot = 0;
+	for (j = 0; j < n; j++) {
+		tot += READ_ONCE( r->e[j].count );
+		if (tot > p) {
+			return r->e[j].sym;
+		}
+	}
+
+	return r->e[n - 1].sym;
+}
+
+unsigned char stoch_ctxs_val( const struct _stoch_ctxs *x, u64 ctx, struct _stoch_rng *rng ) {
+	return stoch_srow_val( stoch_ctab_find( stoch_deref( x->ctab ), ctx ), rng );
+}
+
+void stoch_ctxs_start( const struct _stoch_ctxs *x, struct _stoch_chain *c ) {
+	const struct _stoch_ctab *t;
+	const struct _stoch_srow *r;
+	unsigned int i, b, step, v;
+	u64 total, u, s;
+
+	t = stoch_deref( x->ctab );
+	total = READ_ONCE( t->total );
+	smp_rmb();
+	if (total == 0) {
+		// nothing trained yet, the chain ends immediately
+		c->started = 0;
+		return;
+	}
+
+	// descend the tree to the block the draw falls in, then find the row within it
+	u = mul_u64_u64_shr( stoch_rng_next( &c->rng ), total, 64 );
+	b = 0;
+	for (step = (t->mask + 1) / STOCH_CTAB_BLOCK / 2; step > 0; step >>= 1) {
+		s = READ_ONCE( t->sums[b + step - 1] );
+		if (s <= u) {
+			u -= s;
+			b += step;
+		}
+	}
+	smp_rmb();
+	r = NULL;
+	for (i = b * STOCH_CTAB_BLOCK; i < (b + 1) * STOCH_CTAB_BLOCK; i++) {
+		r = stoch_deref( t->slots[i] );
+		if (r) {
+			v = READ_ONCE( r->total );
+			if (u < v) {
+				break;
+			}
+			u -= v;
+		}
+	}
+
+	// a draw racing a halving can miss, any known context will then do
+	for (i &= t->mask; !r; i = (i + 1) & t->mask) {
+		r = stoch_deref( t->slots[i] );
+	}
+	c->ctx = r->ctx;
+	c->started = 1;
+}
+
+size_t stoch_ctxs_gen( const struct _stoch_ctxs *x, struct _stoch_chain *c, unsigned char *buff, size_t size ) {
+	const struct _stoch_ctab *t;
+	size_t i;
+	u64 ctx;
+
+	if (!c->started) {
+		stoch_ctxs_start( x, c );
+		if (!c->started) {
+			return 0;
+		}
+	}
+
+	ctx = c->ctx;
+	t = stoch_deref( x->ctab );
+	for (i = 0; i < size; i++) {
+		buff[i] = stoch_srow_val( stoch_ctab_find( t, ctx ), &c->rng );
+		ctx = ((ctx << 8) | buff[i]) & x->mask;
+		if (buff[i] == 0) {
+			// the chain has ended, the next one starts afresh
+			c->started = 0;
+			break;
+		}
+	}
+	c->ctx = ctx;
+
+	return i;
+}
+
+int stoch_ctxs_init( struct _stoch_ctxs *x, int order ) {
+	struct _stoch_ctab *t;
+
+	x->mask = (order == 8) ? ~0ULL : (1ULL << (8 * order)) - 1;
+
+	x->batch = stoch_plat_zalloc( sizeof(*x->batch) );
+	if (!x->batch) {
+		return -ENOMEM;
+	}
+
+	t = stoch_ctab_alloc( STOCH_CTAB_MIN );
+	if (!t) {
+		stoch_plat_free( x->batch );
+		return -ENOMEM;
+	}
+	stoch_publish( x->ctab, t );
+
+	return 0;
+}
+
+// tables and rows retired by training are left to stoch_retire
+void stoch_ctxs_free( struct _stoch_ctxs *x ) {
+	struct _stoch_ctab *t;
+	struct _stoch_srow *r;
+	unsigned int i;
+
+	t = stoch_deref_writer( x->ctab );
+	for (i = 0; i <= t->mask; i++) {
+		r = stoch_deref_writer( t->slots[i] );
+		if (r) {
+			stoch_plat_free( r->tree );
+			stoch_plat_free( r );
+		}
+	}
+	stoch_plat_free( t );
+	stoch_plat_free( x->batch );
+}
+
+/* ------- counts --------------- */
+
+static inline void stoch_crow_put( struct _stoch_crow *r, unsigned int i, u64 c ) {
+	switch (r->shift) {
+	case 0:
+		WRITE_ONCE( ((u8 *)r->bins)[i], c );
+		break;
+	case 1:
+		WRITE_ONCE( ((u16 *)r->bins)[i], c );
+		break;
+	case 2:
+		WRITE_ONCE( ((u32 *)r->bins)[i], c );
+		break;
+	default:
+		WRITE_ONCE( r->bins[i], c );
+	}
+}
+
+// whether any of the four counters of d from i on is set, a block's rows are mostly empty
+static inline int stoch_count_any4( const u16 *d, unsigned int i ) {
+	u64 w;
+
+	memcpy( &w, d + i, sizeof(w) );
+	return w != 0;
+}
+
+unsigned int stoch_crow_fit( const struct _stoch_crow *r, const u16 *d, unsigned int scale ) {
+	unsigned int shift, i, j;
+	u64 c, top;
+
+	top = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i += 4) {
+		if (!stoch_count_any4( d, i )) {
+			continue;
+		}
+		for (j = i; j < i + 4; j++) {
+			c = (r ? stoch_crow_get( r, j ) : 0) + ((u64)d[j] << scale);
+			top = (c > top) ? c : top;
+		}
+	}
+
+	shift = r ? r->shift : 0;
+	while (shift < 3 && (top >> (8 << shift)) != 0) {
+		shift++;
+	}
+	return shift;
+}
+
+void stoch_crow_widen( struct _stoch_crow *dst, unsigned int shift, const struct _stoch_crow *src ) {
+	unsigned int i;
+
+	memset( dst, 0, STOCH_CROW_SIZE( shift ) );
+	dst->shift = shift;
+	if (src) {
+		dst->total = src->total;
+		dst->base = src->base;
+		for (i = 0; i < STOCH_HIST_SIZE; i++) {
+			stoch_crow_put( dst, i, stoch_crow_get( src, i ) );
+		}
+	}
+}
+
+int stoch_crow_add( struct _stoch_crow *r, u16 *d, unsigned int scale ) {
+	unsigned int i, j, bits;
+	int result = 0;
+	u64 c, n, w;
+
+	bits = 8 << r->shift;
+	n = 0;
+	for (i = 0; i < STOCH_HIST_SIZE && result == 0; i += 4) {
+		if (!stoch_count_any4( d, i )) {
+			continue;
+		}
+		for (j = i; j < i + 4; j++) {
+			if (d[j] == 0) {
+				continue;
+			}
+			w = (u64)d[j] << scale;
+			c = stoch_crow_get( r, j ) + w;
+			if (bits < 64 && (c >> bits) != 0) {
+				result = -EOVERFLOW;
+				break;
+			}
+			stoch_crow_put( r, j, c );
+			n += w;
+			d[j] = 0;
+		}
+	}
+	WRITE_ONCE( r->total, r->total + n );
+
+	return result;
+}
+
+void stoch_crow_rebase( struct _stoch_crow *r, unsigned int base ) {
+	unsigned int i, k;
+	u64 c, total;
+
+	k = base - r->base;
+	total = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		c = stoch_crow_get( r, i );
+		if (c) {
+			c = (k < 64) ? c >> k : 0;
+			stoch_crow_put( r, i, c );
+			total += c;
+		}
+	}
+	WRITE_ONCE( r->total, total );
+	WRITE_ONCE( r->base, base );
+}
+
+void stoch_crow_reset( struct _stoch_crow *r, unsigned int base ) {
+	unsigned int i;
+
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		stoch_crow_put( r, i, 0 );
+	}
+	WRITE_ONCE( r->total, 0 );
+	WRITE_ONCE( r->base, base );
+}
+
+void stoch_hist_set( struct _stoch_hist *h, const u64 *counts ) {
+	unsigned int i, shift;
+	u64 total;
+
+	total = 0;
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		total += counts[i];
+	}
+
+	// leave room for the counts rounded up to one
+	shift = 0;
+	while ((total >> shift) > 0xffffffffULL - STOCH_HIST_SIZE) {
+		shift++;
+	}
+
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		h->data[i] = (unsigned int)(counts[i] >> shift);
+		if (h->data[i] == 0 && counts[i] != 0) {
+			h->data[i] = 1;
+		}
+	}
+	h->total = (unsigned int)(total >> shift);
+}
+
+/* ------- training --------------- */
+
+// add the sub-histograms into row 0 and zero them
+static void stoch_count_merge( struct _stoch_count *cnt ) {
+	int i;
+
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		cnt->rows[0][i] += cnt->sub[0][i] + cnt->sub[1][i] + cnt->sub[2][i] + cnt->sub[3][i];
+	}
+	memset( cnt->sub, 0, sizeof(cnt->sub) );
+}
+
+// spread 8 bytes, taken from one load, over the sub-histograms
+static inline void stoch_count_spread8( u16 *s0, u16 *s1, u16 *s2, u16 *s3, u64 w ) {
+	s0[w & 0xff]++;
+	s1[(w >> 8) & 0xff]++;
+	s2[(w >> 16) & 0xff]++;
+	s3[(w >> 24) & 0xff]++;
+	s0[(w >> 32) & 0xff]++;
+	s1[(w >> 40) & 0xff]++;
+	s2[(w >> 48) & 0xff]++;
+	s3[w >> 56]++;
+}
+
+// spread a block over the sub-histograms
+static void stoch_count_spread( struct _stoch_count *cnt, const unsigned char *buff, size_t size ) {
+	u16 *s0 = cnt->sub[0], *s1 = cnt->sub[1], *s2 = cnt->sub[2], *s3 = cnt->sub[3];
+	size_t i, n;
+	u64 w0, w1, run;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		memcpy( &w0, buff + i, sizeof(w0) );
+		memcpy( &w1, buff + i + 8, sizeof(w1) );
+
+		// a run of one byte would be a chain of increments of one counter, so measure it first
+		run = (w0 & 0xff) * 0x0101010101010101ULL;
+		if (w0 == run && w1 == run) {
+			for (n = 16; i + n + 8 <= size; n += 8) {
+				memcpy( &w1, buff + i + n, sizeof(w1) );
+				if (w1 != run) {
+					break;
+				}
+			}
+			s0[run & 0xff] += n;
+			i += n - 16;
+			continue;
+		}
+
+		stoch_count_spread8( s0, s1, s2, s3, w0 );
+		stoch_count_spread8( s0, s1, s2, s3, w1 );
+	}
+	for (; i < size; i++) {
+		s0[buff[i]]++;
+	}
+}
+
+// mark the rows the context lanes counted and zero them
+static void stoch_count_touched( struct _stoch_count *cnt, unsigned long *touched ) {
+	int i;
+
+	for (i = 0; i < STOCH_HIST_SIZE; i++) {
+		if (cnt->sub[0][i] | cnt->sub[1][i] | cnt->sub[2][i] | cnt->sub[3][i]) {
+			touched[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+		}
+	}
+	memset( cnt->sub, 0, sizeof(cnt->sub) );
+}
+
+/*
+ * Count a block of (context, byte) pairs starting from context row, four
+ * at a time. The contexts go into the sub-histograms for
+ * stoch_count_touched, one lane per position in the block. Returns the
+ * context after the block.
+ */
+static unsigned char stoch_count_pairs( struct _stoch_count *cnt, unsigned char row,
+					const unsigned char *buff, size_t size ) {
+	u16 *s0 = cnt->sub[0], *s1 = cnt->sub[1], *s2 = cnt->sub[2], *s3 = cnt->sub[3];
+	unsigned char x0, x1, x2, x3;
+	size_t i;
+	u32 w;
+
+	for (i = 0; i + 4 <= size; i += 4) {
+		// a run of one byte would be a chain of increments of one counter
+		memcpy( &w, buff + i, sizeof(w) );
+		if (w == row * 0x01010101u) {
+			cnt->rows[row][row] += 4;
+			s0[row]++;
+			continue;
+		}
+
+		x0 = buff[i];
+		x1 = buff[i + 1];
+		x2 = buff[i + 2];
+		x3 = buff[i + 3];
+		cnt->rows[row][x0]++;
+		cnt->rows[x0][x1]++;
+		cnt->rows[x1][x2]++;
+		cnt->rows[x2][x3]++;
+		s0[row]++;
+		s1[x0]++;
+		s2[x1]++;
+		s3[x2]++;
+		row = x3;
+	}
+	for (; i < size; i++) {
+		cnt->rows[row][buff[i]]++;
+		s0[row]++;
+		row = buff[i];
+	}
+
+	return row;
+}
+
+u64 stoch_hist_count( struct _stoch_count *cnt, unsigned int mask, u64 prev,
+		      const unsigned char *buff, size_t size, unsigned long *touched ) {
+	if (size == 0) {
+		return prev;
+	}
+
+	if (mask == 0) {
+		// order 0: the bytes are counted straight into the one row
+		stoch_count_spread( cnt, buff, size );
+		stoch_count_merge( cnt );
+		touched[0] |= 1;
+	} else {
+		// order 1: the context of each byte is the one before it
+		stoch_count_pairs( cnt, (unsigned char)prev, buff, size );
+		stoch_count_touched( cnt, touched );
+	}
+
+	return buff[size - 1];
+}
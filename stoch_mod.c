@@ -0,0 +1,2226 @@
+
+/*
+ * A simple linux device driver / kernel module
+ * It stores a histogram of data written to it and generates (random) output
+ * distributed from the histogram.
+ * Each minor number is an independent model, see stochdev.h, which can be
+ * cleared or replaced while files are open on it.
+ *
+ * This file is the kernel side: devices, models, per-CPU training and RCU
+ * publishing. The histogram and sampling code itself is in stoch_core.c.
+ *
+ * 1. First compile the module,
+ * $ ./mk.sh
+ *
+ * 2. Load the module, udev creates /dev/stoch for the first model
+ * $ insmod stoch.ko
+ *
+ * 3. Write to it to "train" it
+ * $ echo hello > /dev/stoch
+ *
+ * 4. generate random output
+ * $ cat /dev/stoch ----> hllle
+ *
+ * 5. remove the module
+ * rmmod stoch
+ *
+ * Frank James December 2013
+ */
+
+
+
+#include <linux/module.h>	/* Needed by all modules */
+#include <linux/kernel.h>	/* Needed for KERN_INFO */
+#include <linux/init.h>		/* Needed for the macros */
+#include <linux/kernel.h> /* printk() */
+#include <linux/slab.h> /* kmalloc() */
+#include <linux/fs.h> /* everything... */
+#include <linux/errno.h> /* error codes */
+#include <linux/types.h> /* size_t */
+#include <linux/proc_fs.h>
+#include <linux/fcntl.h> /* O_ACCMODE */
+#include <asm/uaccess.h> /* copy_from/to_user */
+#include <linux/random.h>
+
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/bitmap.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/highmem.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h> /* signal_pending() */
+#include <linux/jiffies.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/capability.h>
+#include <linux/ktime.h>
+#include <linux/timex.h> /* get_cycles() */
+#include <linux/workqueue.h>
+
+#include "stoch.h"
+
+// define this to enable debug printk messages
+#if 0
+#define STOCHDBG
+#endif
+
+#define DRIVER_AUTHOR "Frank James <frank.a.james@gmail.com>"
+#define DRIVER_DESC "Simple driver that generates stochastic output"
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR(DRIVER_AUTHOR);
+MODULE_DESCRIPTION(DRIVER_DESC);
+
+/* settings of the first model, later ones pass their own to STOCH_IOC_CREATE */
+
+/* sampling algorithm, see stoch_sampler_names */
+static char *sampler = "alias";
+module_param( sampler, charp, 0444 );
+MODULE_PARM_DESC( sampler, "sampling algorithm: alias (default), cdf, fenwick or scan" );
+
+/* model order: 0 and 1 use dense transition tables, higher orders the context table */
+static int stoch_order = 0;
+module_param_named( order, stoch_order, int, 0444 );
+MODULE_PARM_DESC( order, "model order 0-8, the number of previous bytes each byte depends on (default 0)" );
+
+/* random number source, see stoch_rng_names */
+static char *stoch_rng_name = "fast";
+module_param_named( rng, stoch_rng_name, charp, 0444 );
+MODULE_PARM_DESC( rng, "random source: fast (default, seeded xoshiro) or crypto" );
+
+/* how training data ages, see stoch_mode_names */
+static char *stoch_mode_name = "accumulate";
+module_param_named( mode, stoch_mode_name, charp, 0444 );
+MODULE_PARM_DESC( mode, "how training data ages: accumulate (default), decay or window" );
+
+static int stoch_period = 1000;
+module_param_named( period, stoch_period, int, 0444 );
+MODULE_PARM_DESC( period, "decay half-life or window period in milliseconds (default 1000)" );
+
+static int stoch_window = 8;
+module_param_named( window, stoch_window, int, 0444 );
+MODULE_PARM_DESC( window, "periods in the window, 1-16 (default 8)" );
+
+/* minors reserved, so the most models that can exist at once */
+static int stoch_max_models = 16;
+module_param_named( max_models, stoch_max_models, int, 0444 );
+MODULE_PARM_DESC( max_models, "maximum number of models (default 16)" );
+
+/* function declarations */
+static int stoch_open(struct inode *inode, struct file *filp);
+static int stoch_release(struct inode *inode, struct file *filp);
+static ssize_t stoch_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t stoch_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static int stoch_mmap(struct file *filp, struct vm_area_struct *vma);
+static long stoch_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
+struct _stoch_model;
+struct _stoch_dev;
+
+static void stoch_hists_clear( struct _stoch_model *m );
+static size_t stoch_hist_gen( struct _stoch_model *m, struct _stoch_chain *c, unsigned char *buff, size_t size );
+static ssize_t stoch_hist_train( struct _stoch_model *m, u64 *prev, const unsigned char *buff, size_t size );
+
+/* Structure that declares the usual file access functions */
+struct file_operations stoch_fops = {
+  owner: THIS_MODULE,
+  read_iter: stoch_read_iter,
+  splice_read: copy_splice_read,
+  write_iter: stoch_write_iter,
+  splice_write: iter_file_splice_write,
+  open: stoch_open,
+  release: stoch_release,
+  mmap: stoch_mmap,
+  unlocked_ioctl: stoch_ioctl,
+  compat_ioctl: compat_ptr_ioctl
+};
+
+/*
+ * Per-open-file state. Each file trains and generates its own chain, so
+ * writers on different files don't interleave their transitions and a
+ * reader's chain carries on from one read to the next.
+ */
+struct _stoch_file {
+	struct _stoch_dev *dev; // holds a reference
+	struct _stoch_model *model; // the model the last call used, holds a reference, see stoch_file_model
+	struct mutex lock; // serializes calls sharing this file
+	unsigned char *buf; // STOCH_CHUNK_SIZE scratch buffer
+	struct _stoch_chain chain; // generation state
+	u64 prev; // the last order bytes written, the context of the next training byte
+};
+
+// user buffers are processed in chunks of this size
+#define STOCH_CHUNK_SIZE PAGE_SIZE
+
+/* ------- models --------------- */
+
+/*
+ * One independent model, reached through the minor number it is the
+ * model of (struct _stoch_dev). Everything a model trains into or samples
+ * from hangs off this structure, so models never share tables or locks
+ * with each other.
+ *
+ * Orders 0 and 1 keep a dense row per context (1 or 256 rows, see the hist
+ * section), higher orders use the context table of the order-k section.
+ */
+/*
+ * How a model stores its data. Orders 0 and 1 use per-CPU dense tables
+ * folded into RCU snapshots on read, unless the sampler is fenwick, which
+ * trains and samples shared trees in place. Higher orders use the context
+ * table.
+ */
+#define STOCH_ENGINE_DENSE   0
+#define STOCH_ENGINE_FENWICK 1
+#define STOCH_ENGINE_CTX     2
+
+struct _stoch_model {
+	struct kref ref; // freed after a grace period, see stoch_dev_model
+	struct rcu_head rcu;
+	int frozen; // writes fail with EROFS
+
+	// tunables, fixed when the model is created
+	int order;
+	int sampler;
+	int rng;
+	int engine; // STOCH_ENGINE_, follows from order and sampler
+	int mode; // STOCH_MODE_, how training data ages
+	unsigned long period; // jiffies an epoch lasts, unless accumulating
+	unsigned long epoch0; // jiffies at epoch 0
+
+	// order 0 and 1, both engines
+	unsigned int nrows;
+
+	// dense engine
+	struct _stoch_shard * __percpu *shards;
+	struct _stoch_dist __rcu *rows[STOCH_HIST_SIZE];
+	struct _stoch_dist __rcu *start; // bin i holds the total of row i
+	u64 start_tot[STOCH_HIST_SIZE]; // the row totals as of the last rebuild, under lock
+	unsigned int start_base[STOCH_HIST_SIZE]; // the epoch each total is weighed from
+	unsigned int epochs; // counted rows kept for each row, one per epoch of a window
+	unsigned int built; // the epoch of the last rebuild, under lock
+	unsigned long window[STOCH_WINDOW_MAX][BITS_TO_LONGS(STOCH_HIST_SIZE)]; // rows counted in each epoch
+	struct stoch_map *map; // read-only copy of the sampling tables for userspace, see stochdev.h
+	size_t map_size;
+	atomic_t mapped; // mappings of map, while there are any writes queue map_work
+	struct delayed_work map_work;
+	struct mutex lock; // serializes building and publishing snapshots
+	struct _stoch_build build; // scratch for building snapshots, under lock
+
+	// fenwick engine
+	struct _stoch_fenwick *fen; // nrows row trees, then the start-state tree
+	spinlock_t fen_lock; // serializes training
+	seqcount_spinlock_t fen_seq; // lets readers retry a draw that raced training
+
+	// order 2 and up
+	struct _stoch_ctxs ctxs;
+	struct mutex ctx_lock; // serializes training
+
+	// set by every write(), kept off the cache lines readers use
+	atomic_t stale ____cacheline_aligned_in_smp;
+};
+
+/*
+ * A minor number and the model behind it. Files open the device rather
+ * than its model, so the model can be replaced under them by
+ * STOCH_IOC_CLEAR and STOCH_IOC_SWAP: publishing the new model is one
+ * pointer update and every file moves to it on its next call.
+ */
+struct _stoch_dev {
+	struct kref ref;
+	int minor;
+	struct cdev *cdev;
+	struct _stoch_model __rcu *model; // holds a reference, replaced under stoch_models_lock
+};
+
+static dev_t stoch_devt;
+static struct class *stoch_class;
+
+// minor number -> device
+static DEFINE_IDR(stoch_models);
+static DEFINE_MUTEX(stoch_models_lock);
+
+/* ------- platform --------------- */
+
+/*
+ * Reader generators are seeded from a per-CPU parent generator, which is
+ * itself reseeded from get_random_bytes every STOCH_RNG_RESEED words.
+ */
+struct _stoch_rng_parent {
+	u64 s[4];
+	unsigned int count;
+};
+
+static DEFINE_PER_CPU(struct _stoch_rng_parent, stoch_rng_pcpu);
+
+void stoch_plat_seed( u64 s[4] ) {
+	struct _stoch_rng_parent *p;
+	int i;
+
+	p = get_cpu_ptr( &stoch_rng_pcpu );
+	if (p->count == 0 || p->count >= STOCH_RNG_RESEED) {
+		do {
+			get_random_bytes( p->s, sizeof(p->s) );
+		} while ((p->s[0] | p->s[1] | p->s[2] | p->s[3]) == 0);
+		p->count = 1;
+	}
+	for (i = 0; i < 4; i++) {
+		s[i] = stoch_xoshiro_next( p->s );
+	}
+	p->count += 4;
+	put_cpu_ptr( &stoch_rng_pcpu );
+}
+
+void stoch_plat_random( void *buf, size_t size ) {
+	get_random_bytes( buf, size );
+}
+
+void *stoch_plat_zalloc( size_t size ) {
+	return kvzalloc( size, GFP_KERNEL );
+}
+
+void stoch_plat_free( void *p ) {
+	kvfree( p );
+}
+
+/*
+ * Training scratch space, only used with preemption disabled. A CPU has
+ * none until it first trains, then enough rows for the highest order it
+ * has trained at: 2.5 KB for order 0, 130 KB for order 1. See
+ * stoch_crows_train.
+ */
+struct _stoch_scratch {
+	struct _stoch_count *cnt;
+	unsigned int nrows; // rows cnt has room for
+};
+
+static DEFINE_PER_CPU(struct _stoch_scratch, stoch_count_pcpu);
+
+static void stoch_count_free( void ) {
+	int cpu;
+
+	for_each_possible_cpu( cpu ) {
+		kvfree( per_cpu( stoch_count_pcpu, cpu ).cnt );
+		per_cpu( stoch_count_pcpu, cpu ).cnt = NULL;
+		per_cpu( stoch_count_pcpu, cpu ).nrows = 0;
+	}
+}
+
+/* ------- mmap --------------- */
+
+// allocate a zeroed map with nrows tables that can be mapped into userspace
+static struct stoch_map *stoch_map_alloc( unsigned int nrows, size_t *size ) {
+	struct stoch_map *map;
+
+	*size = PAGE_ALIGN( sizeof(struct stoch_map) + nrows * sizeof(struct stoch_map_table) );
+	map = vmalloc_user( *size );
+	if (map) {
+		map->magic = STOCH_MAP_MAGIC;
+		map->version = STOCH_MAP_VERSION;
+		map->nrows = nrows;
+	}
+	return map;
+}
+
+// bracket updates to the map so userspace readers can detect them
+static void stoch_map_begin( struct stoch_map *map ) {
+	WRITE_ONCE( map->seq, map->seq + 1 );
+	smp_wmb();
+}
+
+static void stoch_map_end( struct stoch_map *map ) {
+	smp_wmb();
+	WRITE_ONCE( map->seq, map->seq + 1 );
+}
+
+static void stoch_map_put( struct stoch_map_table *t, const struct _stoch_alias *a ) {
+	memcpy( t->prob, a->prob, sizeof(t->prob) );
+	memcpy( t->alias, a->alias, sizeof(t->alias) );
+	t->total = a->total;
+}
+
+// map the tables read-only
+static int stoch_map_mmap( struct stoch_map *map, struct vm_area_struct *vma ) {
+	if (!map) {
+		return -ENODEV;
+	}
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+	vm_flags_clear( vma, VM_MAYWRITE );
+
+	return remap_vmalloc_range( vma, map, vma->vm_pgoff );
+}
+
+/* ------- iov_iter --------------- */
+
+/*
+ * Kernel memory at the start of an iterator, so output can be generated
+ * and training data counted in place instead of through the scratch page.
+ * Splice hands the driver pipe pages this way (ITER_BVEC), kernel_read and
+ * kernel_write plain buffers (ITER_KVEC). *len is trimmed to what is
+ * contiguous there. User memory returns NULL and has to be copied.
+ */
+static void *stoch_iter_map( struct iov_iter *i, size_t *len ) {
+	const struct bio_vec *bv;
+	size_t n, off;
+
+	if (iov_iter_is_kvec( i )) {
+		n = min_t( size_t, *len, i->kvec->iov_len - i->iov_offset );
+		if (n == 0) {
+			return NULL;
+		}
+		*len = n;
+		return i->kvec->iov_base + i->iov_offset;
+	}
+
+	if (iov_iter_is_bvec( i )) {
+		bv = i->bvec;
+		off = bv->bv_offset + i->iov_offset;
+		n = min3( *len, (size_t)(bv->bv_len - i->iov_offset), PAGE_SIZE - offset_in_page( off ) );
+		if (n == 0) {
+			return NULL;
+		}
+		*len = n;
+		return kmap_local_page( bv->bv_page + off / PAGE_SIZE ) + offset_in_page( off );
+	}
+
+	return NULL;
+}
+
+static void stoch_iter_unmap( struct iov_iter *i, void *p ) {
+	if (iov_iter_is_bvec( i )) {
+		kunmap_local( p );
+	}
+}
+
+/* ------- hist --------------- */
+
+/*
+ * Immutable snapshot of one transition row, or of the start-state
+ * distribution. Each row is published under RCU on its own, so a rebuild
+ * after a write only replaces the rows that write touched. Readers always
+ * sample from an internally consistent row. A row is allocated short,
+ * d ends with the table of the model's sampler, or the alias table of a
+ * sparse row.
+ */
+struct _stoch_row {
+	struct rcu_head rcu;
+	struct _stoch_dist d;
+};
+
+// allocate a row big enough for the distribution of h drawn with sampler
+static struct _stoch_row *stoch_row_alloc( const struct _stoch_hist *h, int sampler ) {
+	return kzalloc( offsetof( struct _stoch_row, d ) + stoch_dist_size( h, sampler ), GFP_KERNEL );
+}
+
+// rows that have never been trained all point here
+static struct _stoch_row stoch_row_empty;
+
+/*
+ * Per-CPU training shard. Writers count into their own CPU's rows and mark
+ * the rows they touched in dirty, readers fold only the dirty rows. A row
+ * is allocated the first time it is trained and replaced under RCU when
+ * its counters are widened, only ever by the CPU that owns the shard. A
+ * window keeps the rows of each epoch apart, the model's epochs sets of
+ * nrows one after the other.
+ */
+struct _stoch_shard {
+	DECLARE_BITMAP(dirty, STOCH_HIST_SIZE);
+	struct _stoch_crow __rcu *rows[]; // nrows * epochs
+};
+
+struct _stoch_shard_row {
+	struct rcu_head rcu;
+	struct _stoch_crow c;
+};
+
+// free every row of a table of nrows counted rows, with no writers left
+static void stoch_crows_free( struct _stoch_crow __rcu **rows, unsigned int nrows ) {
+	struct _stoch_crow *r;
+	unsigned int i;
+
+	for (i = 0; i < nrows; i++) {
+		r = rcu_replace_pointer( rows[i], NULL, true );
+		if (r) {
+			kfree_rcu( container_of( r, struct _stoch_shard_row, c ), rcu );
+		}
+	}
+}
+
+static struct _stoch_shard *stoch_shard_get( struct _stoch_model *m, int cpu ) {
+	return *per_cpu_ptr( m->shards, cpu );
+}
+
+static void stoch_shards_free( struct _stoch_model *m ) {
+	struct _stoch_shard *s;
+	int cpu;
+
+	if (!m->shards) {
+		return;
+	}
+	for_each_possible_cpu( cpu ) {
+		s = stoch_shard_get( m, cpu );
+		if (s) {
+			stoch_crows_free( s->rows, m->nrows * m->epochs );
+			kvfree( s );
+		}
+	}
+	free_percpu( m->shards );
+	m->shards = NULL;
+}
+
+// rows are allocated as they are trained, keep them on the node that trains them
+static int stoch_shards_alloc( struct _stoch_model *m ) {
+	struct _stoch_shard *s;
+	int cpu;
+
+	m->shards = alloc_percpu( struct _stoch_shard * );
+	if (!m->shards) {
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu( cpu ) {
+		s = kvzalloc_node( sizeof(*s) + m->nrows * m->epochs * sizeof(s->rows[0]), GFP_KERNEL, cpu_to_node( cpu ) );
+		if (!s) {
+			stoch_shards_free( m );
+			return -ENOMEM;
+		}
+		*per_cpu_ptr( m->shards, cpu ) = s;
+	}
+
+	return 0;
+}
+
+static struct _stoch_dist *stoch_row_get( struct _stoch_model *m, int i ) {
+	return rcu_dereference_protected( m->rows[i], lockdep_is_held( &m->lock ) );
+}
+
+// replace *slot with r and retire what it held
+static void stoch_row_swap( struct _stoch_model *m, struct _stoch_dist __rcu **slot, struct _stoch_row *r ) {
+	struct _stoch_dist *old;
+
+	old = rcu_dereference_protected( *slot, lockdep_is_held( &m->lock ) );
+	rcu_assign_pointer( *slot, &r->d );
+	if (old && old != &stoch_row_empty.d) {
+		kfree_rcu( container_of( old, struct _stoch_row, d ), rcu );
+	}
+}
+
+// the epoch a model is in, the periods since it was created
+static unsigned int stoch_model_epoch( struct _stoch_model *m ) {
+	if (m->mode == STOCH_MODE_ACCUMULATE) {
+		return 0;
+	}
+	return (unsigned int)((jiffies - m->epoch0) / m->period);
+}
+
+// the newest base of the shards' counts for decaying row i, the one they are summed at
+static unsigned int stoch_row_base( struct _stoch_model *m, int i ) {
+	struct _stoch_crow *c;
+	unsigned int base, b;
+	int cpu, found = 0;
+
+	base = 0;
+	for_each_possible_cpu( cpu ) {
+		c = rcu_dereference( stoch_shard_get( m, cpu )->rows[i] );
+		if (c) {
+			b = READ_ONCE( c->base );
+			if (!found || (int)(b - base) > 0) {
+				base = b;
+			}
+			found = 1;
+		}
+	}
+
+	return base;
+}
+
+// sum row i over the shards and, in a window, the epochs still in it into a new snapshot and publish it
+static int stoch_row_rebuild( struct _stoch_model *m, int i, unsigned int epoch ) {
+	struct _stoch_crow *c;
+	struct _stoch_row *r;
+	unsigned int base, shift, k;
+	u64 *sum, total;
+	int j, cpu;
+
+	// total the row in 64 bits, the build scratch is free until stoch_dist_build
+	sum = m->build.w;
+	memset( sum, 0, STOCH_HIST_SIZE * sizeof(*sum) );
+	rcu_read_lock();
+	base = (m->mode == STOCH_MODE_DECAY) ? stoch_row_base( m, i ) : 0;
+	for_each_possible_cpu( cpu ) {
+		for (k = 0; k < m->epochs; k++) {
+			c = rcu_dereference( stoch_shard_get( m, cpu )->rows[k * m->nrows + i] );
+			if (!c) {
+				continue;
+			}
+
+			shift = 0;
+			if (m->mode == STOCH_MODE_DECAY) {
+				shift = base - READ_ONCE( c->base );
+			} else if (m->mode == STOCH_MODE_WINDOW) {
+				if (epoch - READ_ONCE( c->base ) >= m->epochs) {
+					continue;
+				}
+				// still in the window, so the row must be rebuilt when the epoch leaves it
+				set_bit( i, m->window[k] );
+			}
+			if (shift >= 64) {
+				continue;
+			}
+
+			for (j = 0; j < STOCH_HIST_SIZE; j++) {
+				sum[j] += stoch_crow_get( c, j ) >> shift;
+			}
+		}
+	}
+	rcu_read_unlock();
+	total = 0;
+	for (j = 0; j < STOCH_HIST_SIZE; j++) {
+		total += sum[j];
+	}
+	stoch_hist_set( &m->build.hist, sum );
+
+	r = stoch_row_alloc( &m->build.hist, m->sampler );
+	if (!r) {
+		return -ENOMEM;
+	}
+	stoch_dist_build( &r->d, stoch_row_get( m, i ), &m->build.hist, m->sampler, &m->build );
+	m->start_tot[i] = total;
+	m->start_base[i] = base;
+
+	stoch_row_swap( m, &m->rows[i], r );
+
+	stoch_map_begin( m->map );
+	stoch_map_put( &m->map->rows[i], &m->build.alias );
+	stoch_map_end( m->map );
+
+	return 0;
+}
+
+// publish a new start-state distribution from the current row totals
+static void stoch_start_rebuild( struct _stoch_model *m ) {
+	struct _stoch_hist *h = &m->build.hist;
+	struct _stoch_row *st;
+	unsigned int ref, k;
+	u64 *w = m->build.w;
+	int i, found = 0;
+
+	// decaying totals are compared at the newest base, so older rows count for less
+	ref = 0;
+	for (i = 0; i < m->nrows; i++) {
+		if (m->start_tot[i] && (!found || (int)(m->start_base[i] - ref) > 0)) {
+			ref = m->start_base[i];
+			found = 1;
+		}
+	}
+
+	// the totals are kept as rows are rebuilt rather than read from every row
+	memset( w, 0, STOCH_HIST_SIZE * sizeof(*w) );
+	for (i = 0; i < m->nrows; i++) {
+		k = ref - m->start_base[i];
+		w[i] = (k < 64) ? m->start_tot[i] >> k : 0;
+	}
+	stoch_hist_set( h, w );
+
+	// chains are always started through the alias table
+	st = stoch_row_alloc( h, STOCH_SAMPLER_ALIAS );
+	if (!st) {
+		atomic_set( &m->stale, 1 );
+		return;
+	}
+	stoch_dist_build( &st->d, rcu_dereference_protected( m->start, lockdep_is_held( &m->lock ) ), h,
+			  STOCH_SAMPLER_ALIAS, &m->build );
+
+	stoch_row_swap( m, &m->start, st );
+
+	stoch_map_begin( m->map );
+	stoch_map_put( &m->map->start, &m->build.alias );
+	stoch_map_end( m->map );
+}
+
+// drop all training data and publish empty rows, while nothing trains the model
+static void stoch_hists_clear( struct _stoch_model *m ) {
+	struct _stoch_shard *s;
+	int i, cpu;
+
+	// there are no writers yet
+	for_each_possible_cpu( cpu ) {
+		s = stoch_shard_get( m, cpu );
+		bitmap_zero( s->dirty, STOCH_HIST_SIZE );
+		stoch_crows_free( s->rows, m->nrows * m->epochs );
+	}
+
+	mutex_lock( &m->lock );
+	stoch_map_begin( m->map );
+	for (i = 0; i < m->nrows; i++) {
+		stoch_row_swap( m, &m->rows[i], &stoch_row_empty );
+		m->map->rows[i].total = 0;
+	}
+	memset( m->start_tot, 0, sizeof(m->start_tot) );
+	memset( m->start_base, 0, sizeof(m->start_base) );
+	memset( m->window, 0, sizeof(m->window) );
+	m->built = stoch_model_epoch( m );
+	stoch_map_end( m->map );
+	stoch_start_rebuild( m );
+	mutex_unlock( &m->lock );
+}
+
+// rebuild every row touched by a writer, or in a window left by an epoch, since the last rebuild
+static void stoch_hists_rebuild( struct _stoch_model *m ) {
+	DECLARE_BITMAP(rows, STOCH_HIST_SIZE);
+	struct _stoch_shard *s;
+	unsigned int epoch, n, t;
+	int i, cpu;
+
+	epoch = stoch_model_epoch( m );
+
+	// claim the dirty rows; a writer racing with us just marks them again
+	bitmap_zero( rows, STOCH_HIST_SIZE );
+	for_each_possible_cpu( cpu ) {
+		s = stoch_shard_get( m, cpu );
+		for (i = 0; i < BITS_TO_LONGS(STOCH_HIST_SIZE); i++) {
+			rows[i] |= xchg( &s->dirty[i], 0 );
+		}
+	}
+
+	// the epochs that left the window since the last rebuild take their rows with them
+	if (m->mode == STOCH_MODE_WINDOW) {
+		n = min( epoch - m->built, m->epochs );
+		for (t = epoch - n + 1; t != epoch + 1; t++) {
+			for (i = 0; i < BITS_TO_LONGS(STOCH_HIST_SIZE); i++) {
+				rows[i] |= xchg( &m->window[t % m->epochs][i], 0 );
+			}
+		}
+	}
+	m->built = epoch;
+
+	for_each_set_bit( i, rows, STOCH_HIST_SIZE ) {
+		if (stoch_row_rebuild( m, i, epoch ) < 0) {
+			// keep serving the old row and retry on the next read
+			s = stoch_shard_get( m, raw_smp_processor_id() );
+			set_bit( i, s->dirty );
+			atomic_set( &m->stale, 1 );
+		}
+	}
+
+	stoch_start_rebuild( m );
+}
+
+/*
+ * Publish new snapshots if writes happened since the last ones. If another
+ * reader is already rebuilding we carry on with the current snapshots
+ * rather than wait for it.
+ */
+static void stoch_hists_refresh( struct _stoch_model *m ) {
+	int moved;
+
+	// a window also moves on without writes
+	moved = m->mode == STOCH_MODE_WINDOW && stoch_model_epoch( m ) != READ_ONCE( m->built );
+	if (!atomic_read( &m->stale ) && !moved) {
+		return;
+	}
+
+	if (!mutex_trylock( &m->lock )) {
+		return;
+	}
+	if (atomic_xchg( &m->stale, 0 ) || moved) {
+		stoch_hists_rebuild( m );
+	}
+	mutex_unlock( &m->lock );
+}
+
+// most a mapping lags behind the writes, which this also batches
+#define STOCH_MAP_LAG_MS 10
+
+/*
+ * Rebuild the tables of a mapped model, which may have no reader to do it
+ * otherwise. Queued by writes, and at every period of a window, which
+ * moves on without them, for as long as the model is mapped.
+ */
+static void stoch_map_work( struct work_struct *work ) {
+	struct _stoch_model *m = container_of( to_delayed_work( work ), struct _stoch_model, map_work );
+	unsigned long next;
+
+	mutex_lock( &m->lock );
+	if (atomic_xchg( &m->stale, 0 ) || (m->mode == STOCH_MODE_WINDOW && stoch_model_epoch( m ) != m->built)) {
+		stoch_hists_rebuild( m );
+	}
+	mutex_unlock( &m->lock );
+
+	if (m->mode == STOCH_MODE_WINDOW && atomic_read( &m->mapped )) {
+		next = m->period - (jiffies - m->epoch0) % m->period;
+		queue_delayed_work( system_wq, &m->map_work, next );
+	}
+}
+
+static void stoch_hists_free( struct _stoch_model *m ) {
+	struct _stoch_dist *d;
+	int i;
+
+	// nothing maps the model any more, but the work may still be queued
+	cancel_delayed_work_sync( &m->map_work );
+
+	for (i = 0; i < m->nrows; i++) {
+		d = rcu_access_pointer( m->rows[i] );
+		if (d && d != &stoch_row_empty.d) {
+			kfree( container_of( d, struct _stoch_row, d ) );
+		}
+	}
+	d = rcu_access_pointer( m->start );
+	if (d) {
+		kfree( container_of( d, struct _stoch_row, d ) );
+	}
+	vfree( m->map );
+	stoch_shards_free( m );
+}
+
+static int stoch_hists_init( struct _stoch_model *m ) {
+	int i, result;
+
+	m->nrows = (m->order == 0) ? 1 : STOCH_HIST_SIZE;
+	atomic_set( &m->mapped, 0 );
+	INIT_DELAYED_WORK( &m->map_work, stoch_map_work );
+
+	result = stoch_shards_alloc( m );
+	if (result < 0) {
+		printk( KERN_INFO "stoch: cannot allocate training shards\n" );
+		return result;
+	}
+
+	m->map = stoch_map_alloc( m->nrows, &m->map_size );
+	if (!m->map) {
+		stoch_shards_free( m );
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < m->nrows; i++) {
+		RCU_INIT_POINTER( m->rows[i], &stoch_row_empty.d );
+	}
+
+	// clear out the histograms, this also publishes the first start table
+	stoch_hists_clear( m );
+	if (!rcu_access_pointer( m->start )) {
+		stoch_hists_free( m );
+		return -ENOMEM;
+	}
+	atomic_set( &m->stale, 0 );
+
+	return 0;
+}
+
+// start a chain from a state drawn from the start-state distribution
+static void stoch_hist_start( struct _stoch_model *m, struct _stoch_chain *c ) {
+	rcu_read_lock();
+	stoch_chain_start( c, rcu_dereference( m->start ) );
+	rcu_read_unlock();
+
+#ifdef STOCHDBG
+	printk( KERN_INFO "stoch: prev %d\n", (int)c->ctx );
+#endif
+}
+
+// continue the chain into buff, stopping early if a 0 is generated
+static size_t stoch_hist_gen( struct _stoch_model *m, struct _stoch_chain *c, unsigned char *buff, size_t size ) {
+	size_t i;
+
+	if (!c->started) {
+		stoch_hist_start( m, c );
+		if (!c->started) {
+			return 0;
+		}
+	}
+
+	// now generate the buffer output, order 0 only has row 0
+	rcu_read_lock();
+	i = stoch_chain_gen( c, m->sampler, m->rows, m->nrows - 1, buff, size );
+	rcu_read_unlock();
+
+#ifdef STOCHDBG
+	printk( KERN_INFO "stoch: pos %d\n", (int)i );
+#endif
+
+	return i;
+}
+
+/*
+ * A row or scratch space for stoch_crows_train that could not be had
+ * without sleeping: the caller allocates what was asked for and calls
+ * again, and frees what is left over at the end.
+ */
+struct _stoch_grow {
+	struct _stoch_shard_row *spare; // not yet in any shard
+	unsigned int shift; // what spare holds, or is wanted
+	struct _stoch_count *cnt; // scratch not yet any CPU's, or one a CPU outgrew
+	unsigned int nrows; // rows cnt holds
+	unsigned int want; // rows of scratch asked for, 0 if it was a row
+};
+
+// allocate what stoch_crows_train asked for, where we can sleep
+static int stoch_grow_alloc( struct _stoch_grow *g ) {
+	if (g->want) {
+		kvfree( g->cnt );
+		g->nrows = 0;
+		g->cnt = kvzalloc( STOCH_COUNT_SIZE( g->want ), GFP_KERNEL );
+		if (!g->cnt) {
+			return -ENOMEM;
+		}
+		g->nrows = g->want;
+		return 0;
+	}
+
+	kfree( g->spare );
+	g->spare = kmalloc( sizeof(*g->spare) + (STOCH_HIST_SIZE << g->shift), GFP_KERNEL );
+	return g->spare ? 0 : -ENOMEM;
+}
+
+/*
+ * How far counts of epoch are shifted to add them to r. An epoch before
+ * the row's base, from a writer that read it before another started the
+ * row, counts as the base itself, as stoch_row_base compares them.
+ */
+static unsigned int stoch_crow_scale( const struct _stoch_crow *r, int mode, unsigned int epoch ) {
+	if (mode != STOCH_MODE_DECAY || (int)(epoch - r->base) < 0) {
+		return 0;
+	}
+	return epoch - r->base;
+}
+
+/*
+ * Make room in *slot for one row of a counted block, starting or widening
+ * the row as needed, so d can then be added without overflowing. Decaying
+ * counts are rebased as they near their span, and a window's row still
+ * holding an earlier epoch's counts is emptied first. With the CPU held a
+ * new row comes from g's spare or GFP_NOWAIT; failing both, -EAGAIN is
+ * returned with the shift wanted in g.
+ */
+static int stoch_crow_ready( struct _stoch_crow __rcu **slot, const u16 *d, int mode, unsigned int epoch,
+			     struct _stoch_grow *g ) {
+	struct _stoch_shard_row *n;
+	struct _stoch_crow *r;
+	unsigned int shift, scale;
+
+	r = rcu_dereference_protected( *slot, true );
+	scale = 0;
+	if (r && mode == STOCH_MODE_DECAY) {
+		if ((int)(epoch - r->base) > STOCH_DECAY_SPAN) {
+			stoch_crow_rebase( r, epoch - STOCH_DECAY_SPAN / 2 );
+		}
+		scale = stoch_crow_scale( r, mode, epoch );
+	} else if (r && mode == STOCH_MODE_WINDOW && (int)(epoch - r->base) > 0) {
+		stoch_crow_reset( r, epoch );
+	}
+
+	shift = stoch_crow_fit( r, d, scale );
+	if (r && shift == r->shift) {
+		return 0;
+	}
+
+	if (g->spare && g->shift >= shift) {
+		n = g->spare;
+		shift = g->shift;
+		g->spare = NULL;
+	} else {
+		n = kmalloc( sizeof(*n) + (STOCH_HIST_SIZE << shift), GFP_NOWAIT | __GFP_NOWARN );
+		if (!n) {
+			g->shift = shift;
+			return -EAGAIN;
+		}
+	}
+	stoch_crow_widen( &n->c, shift, r );
+	if (!r) {
+		n->c.base = epoch;
+	}
+
+	rcu_assign_pointer( *slot, &n->c );
+	if (r) {
+		kfree_rcu( container_of( r, struct _stoch_shard_row, c ), rcu );
+	}
+	return 0;
+}
+
+/*
+ * Count a buffer of training data into rows a block at a time, folding
+ * each block into the rows it touched. Only the owner of rows may call
+ * this, with preemption disabled. A block is counted whole or not at all:
+ * room is made in every row it touched before any is added to. Returns
+ * the bytes counted, which is short of size if a row, or this CPU's
+ * scratch, could not be had without sleeping; see struct _stoch_grow.
+ */
+static size_t stoch_crows_train( struct _stoch_crow __rcu **rows, unsigned int mask, int mode, unsigned int epoch,
+				 u64 *prev, const unsigned char *buff, size_t size, unsigned long *touched,
+				 struct _stoch_grow *g ) {
+	struct _stoch_scratch *sc = this_cpu_ptr( &stoch_count_pcpu );
+	DECLARE_BITMAP(block, STOCH_HIST_SIZE);
+	struct _stoch_count *cnt;
+	struct _stoch_crow *r;
+	size_t i, n;
+	u64 next;
+	int j, result = 0;
+
+	// the first time this CPU trains at this order, swap in scratch the caller allocated
+	if (sc->nrows < mask + 1) {
+		if (g->nrows < mask + 1) {
+			g->want = mask + 1;
+			return 0;
+		}
+		swap( sc->cnt, g->cnt );
+		swap( sc->nrows, g->nrows );
+	}
+	cnt = sc->cnt;
+	g->want = 0;
+
+	for (i = 0; i < size; i += n) {
+		n = min_t( size_t, size - i, STOCH_COUNT_BLOCK );
+		bitmap_zero( block, STOCH_HIST_SIZE );
+		next = stoch_hist_count( cnt, mask, *prev, buff + i, n, block );
+
+		for_each_set_bit( j, block, STOCH_HIST_SIZE ) {
+			result = stoch_crow_ready( &rows[j], cnt->rows[j], mode, epoch, g );
+			if (result < 0) {
+				break;
+			}
+		}
+		if (result < 0) {
+			// the scratch is shared, leave it zeroed; the block is counted again once the row is had
+			for_each_set_bit( j, block, STOCH_HIST_SIZE ) {
+				memset( cnt->rows[j], 0, sizeof(cnt->rows[j]) );
+			}
+			break;
+		}
+
+		for_each_set_bit( j, block, STOCH_HIST_SIZE ) {
+			r = rcu_dereference_protected( rows[j], true );
+			stoch_crow_add( r, cnt->rows[j], stoch_crow_scale( r, mode, epoch ) );
+		}
+		bitmap_or( touched, touched, block, STOCH_HIST_SIZE );
+		*prev = next;
+	}
+
+	return i;
+}
+
+/*
+ * Count a buffer of training data into this CPU's shard, advancing the
+ * chain state. Rows that cannot be allocated with the CPU held are
+ * allocated after dropping it and the block is counted again, on whichever
+ * CPU we are then on. Returns the bytes counted, or -ENOMEM if none were.
+ */
+static ssize_t stoch_hist_train( struct _stoch_model *m, u64 *prev, const unsigned char *buff, size_t size ) {
+	struct _stoch_grow g = { NULL, 0, NULL, 0, 0 };
+	struct _stoch_shard *s;
+	DECLARE_BITMAP(rows, STOCH_HIST_SIZE);
+	unsigned int epoch, k;
+	size_t done;
+	int j;
+
+	done = 0;
+	for (;;) {
+		// no other CPU writes to our shard
+		bitmap_zero( rows, STOCH_HIST_SIZE );
+		s = *get_cpu_ptr( m->shards );
+
+		// read with the CPU held, a retry may have slept into a later epoch; a window counts each into its own rows
+		epoch = stoch_model_epoch( m );
+		k = (m->mode == STOCH_MODE_WINDOW) ? epoch % m->epochs : 0;
+		done += stoch_crows_train( s->rows + k * m->nrows, m->nrows - 1, m->mode, epoch, prev,
+					   buff + done, size - done, rows, &g );
+
+		// publish the counts before the dirty rows that tell readers to fold them
+		smp_mb__before_atomic();
+		for_each_set_bit( j, rows, STOCH_HIST_SIZE ) {
+			set_bit( j, s->dirty );
+			// and note the row has counts to lose when the epoch leaves the window
+			if (m->mode == STOCH_MODE_WINDOW && !test_bit( j, m->window[k] )) {
+				set_bit( j, m->window[k] );
+			}
+		}
+		smp_mb__after_atomic();
+		put_cpu_ptr( m->shards );
+
+		if (done == size || stoch_grow_alloc( &g ) < 0) {
+			break;
+		}
+	}
+	kfree( g.spare );
+	kvfree( g.cnt );
+
+	if (done == 0 && size > 0) {
+		return -ENOMEM;
+	}
+	return done;
+}
+
+/* ------- fenwick --------------- */
+
+/*
+ * Models with the fenwick sampler keep a tree per row plus one for the
+ * start state and train and sample them in place. Nothing is rebuilt, so
+ * small writes and reads can be interleaved without any table thrashing.
+ * Writers take fen_lock and update the trees STOCH_FEN_SLICE bytes at a
+ * time inside fen_seq, readers retry any draw that overlapped one.
+ */
+#define STOCH_FEN_SLICE 64
+
+static int stoch_fen_init( struct _stoch_model *m ) {
+	m->nrows = (m->order == 0) ? 1 : STOCH_HIST_SIZE;
+	m->fen = kvzalloc( (m->nrows + 1) * sizeof(*m->fen), GFP_KERNEL );
+	if (!m->fen) {
+		return -ENOMEM;
+	}
+	spin_lock_init( &m->fen_lock );
+	seqcount_spinlock_init( &m->fen_seq, &m->fen_lock );
+
+	return 0;
+}
+
+static void stoch_fen_free( struct _stoch_model *m ) {
+	kvfree( m->fen );
+}
+
+static u64 stoch_fen_train( struct _stoch_model *m, u64 prev, const unsigned char *buff, size_t size ) {
+	size_t i, n;
+
+	for (i = 0; i < size; i += n) {
+		n = min_t( size_t, size - i, STOCH_FEN_SLICE );
+
+		spin_lock( &m->fen_lock );
+		write_seqcount_begin( &m->fen_seq );
+		prev = stoch_fenwick_count( m->fen, &m->fen[m->nrows], m->nrows - 1, prev, buff + i, n );
+		write_seqcount_end( &m->fen_seq );
+		spin_unlock( &m->fen_lock );
+	}
+
+	return prev;
+}
+
+// a retried draw takes a fresh random word, so retries do not bias it
+static unsigned char stoch_fen_val( struct _stoch_model *m, const struct _stoch_fenwick *t, struct _stoch_rng *rng ) {
+	unsigned int seq;
+	unsigned char x;
+
+	do {
+		seq = read_seqcount_begin( &m->fen_seq );
+		x = stoch_fenwick_val( t, rng );
+	} while (read_seqcount_retry( &m->fen_seq, seq ));
+
+	return x;
+}
+
+static void stoch_fen_start( struct _stoch_model *m, struct _stoch_chain *c ) {
+	const struct _stoch_fenwick *start = &m->fen[m->nrows];
+
+	c->ctx = 0;
+	c->started = 0;
+	if (stoch_fenwick_total( start ) == 0) {
+		// nothing trained yet, the chain ends immediately
+		return;
+	}
+	c->ctx = stoch_fen_val( m, start, &c->rng );
+	c->started = 1;
+}
+
+static size_t stoch_fen_gen( struct _stoch_model *m, struct _stoch_chain *c, unsigned char *buff, size_t size ) {
+	unsigned int mask = m->nrows - 1;
+	unsigned char prev;
+	size_t i;
+
+	if (!c->started) {
+		stoch_fen_start( m, c );
+		if (!c->started) {
+			return 0;
+		}
+	}
+
+	prev = (unsigned char)c->ctx;
+	for (i = 0; i < size; i++) {
+		buff[i] = stoch_fen_val( m, &m->fen[prev & mask], &c->rng );
+		prev = buff[i];
+		if (buff[i] == 0) {
+			// the chain has ended, the next call starts a new one
+			c->started = 0;
+			break;
+		}
+	}
+	c->ctx = prev;
+
+	return i;
+}
+
+/* ------- order-k contexts --------------- */
+
+/*
+ * For orders above 1 the model is the core's table of contexts, see
+ * stoch.h. Training is serialized by ctx_lock, readers hold
+ * rcu_read_lock.
+ */
+
+static ssize_t stoch_ctx_train( struct _stoch_model *m, u64 *ctx, const unsigned char *buff, size_t size ) {
+	ssize_t result;
+
+	mutex_lock( &m->ctx_lock );
+	result = stoch_ctxs_train( &m->ctxs, ctx, buff, size );
+	mutex_unlock( &m->ctx_lock );
+
+	return result;
+}
+
+static void stoch_ctx_start( struct _stoch_model *m, struct _stoch_chain *c ) {
+	rcu_read_lock();
+	stoch_ctxs_start( &m->ctxs, c );
+	rcu_read_unlock();
+}
+
+static size_t stoch_ctx_gen( struct _stoch_model *m, struct _stoch_chain *c, unsigned char *buff, size_t size ) {
+	size_t n;
+
+	rcu_read_lock();
+	n = stoch_ctxs_gen( &m->ctxs, c, buff, size );
+	rcu_read_unlock();
+
+	return n;
+}
+
+/* ------- benchmark --------------- */
+
+#define STOCH_BENCH_CHUNK STOCH_CHUNK_SIZE // operations timed between reschedules
+
+// a synthetic distribution, with the table or the tree the sampler draws from
+struct _stoch_bench_syn {
+	struct _stoch_hist hist;
+	struct _stoch_dist d;
+	struct _stoch_fenwick fen;
+};
+
+// draw a chain of n values into buff from syn, or from the model if syn is NULL
+static void stoch_bench_sample( struct _stoch_model *m, const struct _stoch_bench_syn *syn, int sampler,
+				struct _stoch_chain *c, unsigned char *buff, size_t n ) {
+	unsigned int mask;
+	size_t i;
+	u64 ctx;
+
+	ctx = c->ctx;
+	rcu_read_lock();
+	if (syn) {
+		for (i = 0; i < n; i++) {
+			if (sampler == STOCH_SAMPLER_FENWICK) {
+				buff[i] = stoch_fenwick_val( &syn->fen, &c->rng );
+			} else {
+				buff[i] = stoch_dist_val( sampler, &syn->d, &c->rng );
+			}
+			ctx = buff[i];
+		}
+	} else if (m->engine == STOCH_ENGINE_DENSE) {
+		mask = m->nrows - 1;
+		for (i = 0; i < n; i++) {
+			buff[i] = stoch_dist_val( sampler, rcu_dereference( m->rows[ctx & mask] ), &c->rng );
+			ctx = buff[i];
+			if (ctx == 0) {
+				stoch_chain_start( c, rcu_dereference( m->start ) );
+				ctx = c->ctx;
+			}
+		}
+	} else if (m->engine == STOCH_ENGINE_FENWICK) {
+		mask = m->nrows - 1;
+		for (i = 0; i < n; i++) {
+			buff[i] = stoch_fen_val( m, &m->fen[ctx & mask], &c->rng );
+			ctx = buff[i];
+			if (ctx == 0) {
+				stoch_fen_start( m, c );
+				ctx = c->ctx;
+			}
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			buff[i] = stoch_ctxs_val( &m->ctxs, ctx, &c->rng );
+			ctx = ((ctx << 8) | buff[i]) & m->ctxs.mask;
+			if (buff[i] == 0) {
+				stoch_ctx_start( m, c );
+				ctx = c->ctx;
+			}
+		}
+	}
+	rcu_read_unlock();
+	c->ctx = ctx;
+}
+
+/*
+ * Run a STOCH_IOC_BENCH request. The work is done a chunk at a time with
+ * only the inner loops timed, so long runs can reschedule and be
+ * interrupted. f->buf holds the values sampled or trained.
+ */
+static int stoch_bench_run( struct _stoch_file *f, struct _stoch_model *m, struct stoch_bench *b ) {
+	struct _stoch_bench_syn *syn = NULL;
+	struct _stoch_crow __rcu **table = NULL;
+	struct _stoch_fenwick *ftable = NULL;
+	struct _stoch_ctxs *ctxs = NULL;
+	struct _stoch_grow grow = { NULL, 0, NULL, 0, 0 };
+	struct _stoch_chain c;
+	DECLARE_BITMAP(rows, STOCH_HIST_SIZE);
+	unsigned int mask;
+	struct _stoch_build *scratch;
+	u64 done, t0, prev;
+	cycles_t c0;
+	size_t n, pos;
+	ssize_t got;
+	int result = 0;
+
+	if (b->dist > STOCH_BENCH_SINGLE || b->op > STOCH_BENCH_TRAIN) {
+		return -EINVAL;
+	}
+	if (b->sampler >= STOCH_SAMPLER_COUNT) {
+		return -EINVAL;
+	}
+	if (b->dist == STOCH_BENCH_LIVE && b->op == STOCH_BENCH_SAMPLE && m->engine == STOCH_ENGINE_DENSE &&
+	    b->sampler != m->sampler) {
+		// the published rows carry only the table of the model's sampler
+		return -EINVAL;
+	}
+
+	if (b->dist != STOCH_BENCH_LIVE) {
+		syn = kzalloc( sizeof(*syn), GFP_KERNEL );
+		scratch = kmalloc( sizeof(*scratch), GFP_KERNEL );
+		if (!syn || !scratch) {
+			kfree( scratch );
+			result = -ENOMEM;
+			goto out;
+		}
+		stoch_hist_synth( &syn->hist, b->dist );
+		stoch_dist_build( &syn->d, NULL, &syn->hist, b->sampler, scratch );
+		stoch_fenwick_build( &syn->fen, &syn->hist );
+		kfree( scratch );
+	}
+
+	if (b->op == STOCH_BENCH_TRAIN && m->engine == STOCH_ENGINE_FENWICK) {
+		ftable = kvzalloc( (m->nrows + 1) * sizeof(*ftable), GFP_KERNEL );
+		if (!ftable) {
+			result = -ENOMEM;
+			goto out;
+		}
+	} else if (b->op == STOCH_BENCH_TRAIN && m->engine == STOCH_ENGINE_CTX) {
+		ctxs = kzalloc( sizeof(*ctxs), GFP_KERNEL );
+		if (!ctxs) {
+			result = -ENOMEM;
+			goto out;
+		}
+		result = stoch_ctxs_init( ctxs, m->order );
+		if (result < 0) {
+			kfree( ctxs );
+			ctxs = NULL;
+			goto out;
+		}
+	} else if (b->op == STOCH_BENCH_TRAIN) {
+		table = kvcalloc( STOCH_HIST_SIZE, sizeof(*table), GFP_KERNEL );
+		if (!table) {
+			result = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (mutex_lock_interruptible( &f->lock )) {
+		result = -ERESTARTSYS;
+		goto out;
+	}
+
+	stoch_rng_init( &c.rng, m->rng );
+	c.ctx = 'a';
+	if (!syn) {
+		switch (m->engine) {
+		case STOCH_ENGINE_DENSE:
+			stoch_hists_refresh( m );
+			stoch_hist_start( m, &c );
+			break;
+		case STOCH_ENGINE_FENWICK:
+			stoch_fen_start( m, &c );
+			break;
+		default:
+			stoch_ctx_start( m, &c );
+		}
+		if (!c.started) {
+			// nothing to sample from
+			result = -ENODATA;
+			goto out_unlock;
+		}
+	}
+
+	// training counts the same page of values over and over
+	if (b->op == STOCH_BENCH_TRAIN) {
+		stoch_bench_sample( m, syn, syn ? b->sampler : m->sampler, &c, f->buf, STOCH_BENCH_CHUNK );
+	}
+
+	// train the way the model would, into a private table
+	mask = (m->order == 0) ? 0 : STOCH_HIST_SIZE - 1;
+	bitmap_zero( rows, STOCH_HIST_SIZE );
+
+	b->ns = 0;
+	b->cycles = 0;
+	prev = 0;
+	done = 0;
+	while (done < b->iters) {
+		n = min_t( u64, b->iters - done, STOCH_BENCH_CHUNK );
+
+		t0 = ktime_get_ns();
+		c0 = get_cycles();
+		if (b->op == STOCH_BENCH_SAMPLE) {
+			stoch_bench_sample( m, syn, b->sampler, &c, f->buf, n );
+		} else if (ftable) {
+			prev = stoch_fenwick_count( ftable, &ftable[m->nrows], m->nrows - 1, prev, f->buf, n );
+		} else if (ctxs) {
+			for (pos = 0; pos < n; pos += got) {
+				got = stoch_ctxs_train( ctxs, &prev, f->buf + pos, n - pos );
+				if (got < 0) {
+					result = got;
+					break;
+				}
+			}
+		} else {
+			for (pos = 0; pos < n && result == 0; ) {
+				preempt_disable();
+				pos += stoch_crows_train( table, mask, STOCH_MODE_ACCUMULATE, 0, &prev, f->buf + pos, n - pos,
+							  rows, &grow );
+				preempt_enable();
+				if (pos < n) {
+					result = stoch_grow_alloc( &grow );
+				}
+			}
+		}
+		b->cycles += get_cycles() - c0;
+		b->ns += ktime_get_ns() - t0;
+		done += n;
+
+		if (result < 0) {
+			break;
+		}
+		if (signal_pending( current )) {
+			result = -ERESTARTSYS;
+			break;
+		}
+		cond_resched();
+	}
+
+out_unlock:
+	mutex_unlock( &f->lock );
+out:
+	if (table) {
+		stoch_crows_free( table, STOCH_HIST_SIZE );
+		kvfree( table );
+	}
+	kvfree( ftable );
+	if (ctxs) {
+		stoch_ctxs_free( ctxs );
+		kfree( ctxs );
+	}
+	kfree( grow.spare );
+	kvfree( grow.cnt );
+	kfree( syn );
+	return result;
+}
+
+/* ------- model instances --------------- */
+
+static int stoch_model_check( const struct stoch_model_conf *conf ) {
+	if (conf->order > STOCH_ORDER_MAX) {
+		return -EINVAL;
+	}
+	if (conf->sampler >= STOCH_SAMPLER_COUNT) {
+		return -EINVAL;
+	}
+	if (conf->rng >= STOCH_RNG_COUNT) {
+		return -EINVAL;
+	}
+	if (conf->mode >= STOCH_MODE_COUNT) {
+		return -EINVAL;
+	}
+
+	// only the dense engine's counts know which epoch they are from
+	if (conf->mode != STOCH_MODE_ACCUMULATE) {
+		if (conf->order > 1 || conf->sampler == STOCH_SAMPLER_FENWICK || conf->period == 0) {
+			return -EINVAL;
+		}
+	}
+	if (conf->mode == STOCH_MODE_WINDOW && (conf->epochs < 1 || conf->epochs > STOCH_WINDOW_MAX)) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+// called when the last reference goes, from the device it was the model of or a file or mapping still using it
+static void stoch_model_release( struct kref *ref ) {
+	struct _stoch_model *m = container_of( ref, struct _stoch_model, ref );
+
+	switch (m->engine) {
+	case STOCH_ENGINE_DENSE:
+		stoch_hists_free( m );
+		break;
+	case STOCH_ENGINE_FENWICK:
+		stoch_fen_free( m );
+		break;
+	default:
+		stoch_ctxs_free( &m->ctxs );
+	}
+
+	// stoch_dev_model may still be looking at the reference count
+	kfree_rcu( m, rcu );
+}
+
+static void stoch_model_put( struct _stoch_model *m ) {
+	kref_put( &m->ref, stoch_model_release );
+}
+
+// a new, untrained model
+static struct _stoch_model *stoch_model_create( const struct stoch_model_conf *conf ) {
+	struct _stoch_model *m;
+	int result;
+
+	result = stoch_model_check( conf );
+	if (result < 0) {
+		return ERR_PTR( result );
+	}
+
+	m = kzalloc( sizeof(*m), GFP_KERNEL );
+	if (!m) {
+		return ERR_PTR( -ENOMEM );
+	}
+	kref_init( &m->ref );
+	mutex_init( &m->lock );
+	mutex_init( &m->ctx_lock );
+	atomic_set( &m->stale, 0 );
+	m->order = conf->order;
+	m->sampler = conf->sampler;
+	m->rng = conf->rng;
+	m->mode = conf->mode;
+	m->period = max( msecs_to_jiffies( conf->period ), 1UL );
+	m->epoch0 = jiffies;
+	m->epochs = (m->mode == STOCH_MODE_WINDOW) ? conf->epochs : 1;
+
+	if (m->order > 1) {
+		m->engine = STOCH_ENGINE_CTX;
+		result = stoch_ctxs_init( &m->ctxs, m->order );
+	} else if (m->sampler == STOCH_SAMPLER_FENWICK) {
+		m->engine = STOCH_ENGINE_FENWICK;
+		result = stoch_fen_init( m );
+	} else {
+		m->engine = STOCH_ENGINE_DENSE;
+		result = stoch_hists_init( m );
+	}
+	if (result < 0) {
+		kfree( m );
+		return ERR_PTR( result );
+	}
+
+	return m;
+}
+
+// the settings m was created with, everything but the minor
+static void stoch_model_conf( const struct _stoch_model *m, struct stoch_model_conf *conf ) {
+	memset( conf, 0, sizeof(*conf) );
+	conf->order = m->order;
+	conf->sampler = m->sampler;
+	conf->rng = m->rng;
+	conf->mode = m->mode;
+	if (m->mode != STOCH_MODE_ACCUMULATE) {
+		conf->period = jiffies_to_msecs( m->period );
+	}
+	if (m->mode == STOCH_MODE_WINDOW) {
+		conf->epochs = m->epochs;
+	}
+	if (READ_ONCE( m->frozen )) {
+		conf->flags |= STOCH_CONF_FROZEN;
+	}
+}
+
+/* ------- devices --------------- */
+
+// called when the last reference goes, the device node is already gone
+static void stoch_dev_release( struct kref *ref ) {
+	struct _stoch_dev *d = container_of( ref, struct _stoch_dev, ref );
+
+	stoch_model_put( rcu_dereference_protected( d->model, true ) );
+	kfree( d );
+}
+
+static void stoch_dev_put( struct _stoch_dev *d ) {
+	kref_put( &d->ref, stoch_dev_release );
+}
+
+// look up the device behind a minor number and take a reference on it
+static struct _stoch_dev *stoch_dev_get( int minor ) {
+	struct _stoch_dev *d;
+
+	mutex_lock( &stoch_models_lock );
+	d = idr_find( &stoch_models, minor );
+	if (d) {
+		kref_get( &d->ref );
+	}
+	mutex_unlock( &stoch_models_lock );
+
+	return d;
+}
+
+/*
+ * Take a reference on the model d has now. A model that has just been
+ * replaced can be on its way out with its count at zero; the one that
+ * replaced it is already published, so we look again.
+ */
+static struct _stoch_model *stoch_dev_model( struct _stoch_dev *d ) {
+	struct _stoch_model *m;
+
+	rcu_read_lock();
+	do {
+		m = rcu_dereference( d->model );
+	} while (!kref_get_unless_zero( &m->ref ));
+	rcu_read_unlock();
+
+	return m;
+}
+
+// put m in as d's model and hand back the one it replaces, called with stoch_models_lock held
+static struct _stoch_model *stoch_dev_replace( struct _stoch_dev *d, struct _stoch_model *m ) {
+	struct _stoch_model *old;
+
+	old = rcu_dereference_protected( d->model, lockdep_is_held( &stoch_models_lock ) );
+	rcu_assign_pointer( d->model, m );
+
+	return old;
+}
+
+// give a device a minor number and a device node, called with stoch_models_lock held
+static int stoch_dev_add( struct _stoch_dev *d ) {
+	struct device *dev;
+	dev_t devt;
+	int result;
+
+	result = idr_alloc( &stoch_models, d, 0, stoch_max_models, GFP_KERNEL );
+	if (result < 0) {
+		return result;
+	}
+	d->minor = result;
+	devt = MKDEV( MAJOR( stoch_devt ), d->minor );
+
+	// open files pin the cdev after the device is gone, so it is not embedded
+	d->cdev = cdev_alloc();
+	if (!d->cdev) {
+		result = -ENOMEM;
+		goto fail;
+	}
+	d->cdev->owner = THIS_MODULE;
+	d->cdev->ops = &stoch_fops;
+	result = cdev_add( d->cdev, devt, 1 );
+	if (result < 0) {
+		kobject_put( &d->cdev->kobj );
+		goto fail;
+	}
+
+	// the first model keeps the /dev/stoch name
+	dev = device_create( stoch_class, NULL, devt, NULL, d->minor ? "stoch%d" : "stoch", d->minor );
+	if (IS_ERR( dev )) {
+		result = PTR_ERR( dev );
+		cdev_del( d->cdev );
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	idr_remove( &stoch_models, d->minor );
+	return result;
+}
+
+static struct _stoch_dev *stoch_dev_create( const struct stoch_model_conf *conf ) {
+	struct _stoch_model *m;
+	struct _stoch_dev *d;
+	int result;
+
+	m = stoch_model_create( conf );
+	if (IS_ERR( m )) {
+		return ERR_CAST( m );
+	}
+
+	d = kzalloc( sizeof(*d), GFP_KERNEL );
+	if (!d) {
+		stoch_model_put( m );
+		return ERR_PTR( -ENOMEM );
+	}
+	kref_init( &d->ref );
+	RCU_INIT_POINTER( d->model, m );
+
+	mutex_lock( &stoch_models_lock );
+	result = stoch_dev_add( d );
+	mutex_unlock( &stoch_models_lock );
+	if (result < 0) {
+		stoch_dev_put( d );
+		return ERR_PTR( result );
+	}
+
+	printk( KERN_INFO "stoch: created model %d, order %d, %s\n", d->minor, m->order, stoch_mode_names[m->mode] );
+
+	return d;
+}
+
+// take a device node away, called with stoch_models_lock held
+static void stoch_dev_remove( struct _stoch_dev *d ) {
+	device_destroy( stoch_class, MKDEV( MAJOR( stoch_devt ), d->minor ) );
+	cdev_del( d->cdev );
+	idr_remove( &stoch_models, d->minor );
+
+	// files that are still open keep the device and its model until they are closed
+	stoch_dev_put( d );
+}
+
+static int stoch_dev_destroy( int minor ) {
+	struct _stoch_dev *d;
+
+	// the first model stays so there is always a device to create models from
+	if (minor == 0) {
+		return -EBUSY;
+	}
+
+	mutex_lock( &stoch_models_lock );
+	d = idr_find( &stoch_models, minor );
+	if (d) {
+		stoch_dev_remove( d );
+	}
+	mutex_unlock( &stoch_models_lock );
+
+	if (!d) {
+		return -ENOENT;
+	}
+	printk( KERN_INFO "stoch: destroyed model %d\n", minor );
+
+	return 0;
+}
+
+/*
+ * Replace d's model with an untrained one with the same settings, frozen
+ * if it was. The lock is held throughout so a swap cannot put another
+ * model in between reading the settings and replacing the model.
+ */
+static int stoch_dev_clear( struct _stoch_dev *d ) {
+	struct stoch_model_conf conf;
+	struct _stoch_model *m, *old;
+
+	mutex_lock( &stoch_models_lock );
+	old = rcu_dereference_protected( d->model, lockdep_is_held( &stoch_models_lock ) );
+	stoch_model_conf( old, &conf );
+	m = stoch_model_create( &conf );
+	if (IS_ERR( m )) {
+		mutex_unlock( &stoch_models_lock );
+		return PTR_ERR( m );
+	}
+	m->frozen = READ_ONCE( old->frozen );
+	stoch_dev_replace( d, m );
+	mutex_unlock( &stoch_models_lock );
+
+	// freed once the last file still using it moves on
+	stoch_model_put( old );
+	printk( KERN_INFO "stoch: cleared model %d\n", d->minor );
+
+	return 0;
+}
+
+// exchange the models of d and the device with the given minor
+static int stoch_dev_swap( struct _stoch_dev *d, int minor ) {
+	struct _stoch_model *m;
+	struct _stoch_dev *e;
+
+	mutex_lock( &stoch_models_lock );
+	e = idr_find( &stoch_models, minor );
+	if (!e || e == d) {
+		mutex_unlock( &stoch_models_lock );
+		return e ? -EINVAL : -ENOENT;
+	}
+
+	// each device's reference goes with its model to the other
+	m = stoch_dev_replace( d, rcu_dereference_protected( e->model, lockdep_is_held( &stoch_models_lock ) ) );
+	stoch_dev_replace( e, m );
+	mutex_unlock( &stoch_models_lock );
+
+	printk( KERN_INFO "stoch: swapped models %d and %d\n", d->minor, minor );
+
+	return 0;
+}
+
+/* --------------------------------- */
+
+static int __init stoch_init( void ) {
+	struct stoch_model_conf conf;
+	struct _stoch_dev *d;
+	int result;
+
+	memset( &conf, 0, sizeof(conf) );
+
+	result = stoch_sampler_parse( sampler );
+	if (result < 0) {
+		printk( KERN_INFO "stoch: unknown sampler %s\n", sampler );
+		return result;
+	}
+	conf.sampler = result;
+
+	result = stoch_rng_parse( stoch_rng_name );
+	if (result < 0) {
+		printk( KERN_INFO "stoch: unknown rng %s\n", stoch_rng_name );
+		return result;
+	}
+	conf.rng = result;
+
+	if (stoch_order < 0 || stoch_order > STOCH_ORDER_MAX) {
+		printk( KERN_INFO "stoch: order must be between 0 and %d\n", STOCH_ORDER_MAX );
+		return -EINVAL;
+	}
+	conf.order = stoch_order;
+
+	result = stoch_mode_parse( stoch_mode_name );
+	if (result < 0) {
+		printk( KERN_INFO "stoch: unknown mode %s\n", stoch_mode_name );
+		return result;
+	}
+	conf.mode = result;
+	if (conf.mode != STOCH_MODE_ACCUMULATE && stoch_period < 1) {
+		printk( KERN_INFO "stoch: period must be at least 1\n" );
+		return -EINVAL;
+	}
+	conf.period = stoch_period;
+	if (conf.mode == STOCH_MODE_WINDOW && (stoch_window < 1 || stoch_window > STOCH_WINDOW_MAX)) {
+		printk( KERN_INFO "stoch: window must be between 1 and %d\n", STOCH_WINDOW_MAX );
+		return -EINVAL;
+	}
+	conf.epochs = stoch_window;
+
+	if (stoch_max_models < 1) {
+		printk( KERN_INFO "stoch: max_models must be at least 1\n" );
+		return -EINVAL;
+	}
+
+	/* Registering device */
+	result = alloc_chrdev_region( &stoch_devt, 0, stoch_max_models, "stoch" );
+	if (result < 0) {
+		printk( KERN_INFO "stoch: cannot obtain a major number\n" );
+		return result;
+	}
+
+	stoch_class = class_create( "stoch" );
+	if (IS_ERR( stoch_class )) {
+		unregister_chrdev_region( stoch_devt, stoch_max_models );
+		return PTR_ERR( stoch_class );
+	}
+
+	d = stoch_dev_create( &conf );
+	if (IS_ERR( d )) {
+		class_destroy( stoch_class );
+		unregister_chrdev_region( stoch_devt, stoch_max_models );
+		return PTR_ERR( d );
+	}
+
+	printk( KERN_INFO "stoch: init, major %d\n", MAJOR( stoch_devt ) );
+
+	return 0;
+}
+
+static void __exit stoch_exit( void ) {
+	struct _stoch_dev *d;
+	int minor;
+
+	printk( KERN_INFO "stoch: exit\n" );
+
+	// no files can be open now, so this frees every model
+	mutex_lock( &stoch_models_lock );
+	idr_for_each_entry( &stoch_models, d, minor ) {
+		stoch_dev_remove( d );
+	}
+	mutex_unlock( &stoch_models_lock );
+	idr_destroy( &stoch_models );
+
+	class_destroy( stoch_class );
+	unregister_chrdev_region( stoch_devt, stoch_max_models );
+
+	// wait for the callbacks freeing retired models, context tables and rows
+	rcu_barrier();
+
+	stoch_count_free();
+}
+
+static int stoch_open(struct inode *inode, struct file *filp) {
+	struct _stoch_file *f;
+	struct _stoch_dev *d;
+	struct _stoch_model *m;
+
+	d = stoch_dev_get( iminor( inode ) );
+	if (!d) {
+		// destroyed while we were opening it
+		return -ENXIO;
+	}
+
+	f = kmalloc( sizeof(*f), GFP_KERNEL );
+	if (!f) {
+		stoch_dev_put( d );
+		return -ENOMEM;
+	}
+
+	f->buf = (unsigned char *)__get_free_page( GFP_KERNEL );
+	if (!f->buf) {
+		kfree( f );
+		stoch_dev_put( d );
+		return -ENOMEM;
+	}
+	m = stoch_dev_model( d );
+	mutex_init( &f->lock );
+	f->dev = d;
+	f->model = m;
+	stoch_rng_init( &f->chain.rng, m->rng );
+	f->chain.started = 0;
+	f->prev = 0;
+
+	filp->private_data = f;
+
+	return 0;
+}
+
+static int stoch_release(struct inode *inode, struct file *filp) {
+	struct _stoch_file *f = filp->private_data;
+
+	stoch_model_put( f->model );
+	stoch_dev_put( f->dev );
+	free_page( (unsigned long)f->buf );
+	kfree( f );
+
+	return 0;
+}
+
+/*
+ * The model calls on f work on, called with f->lock held. A file keeps the
+ * model it used last until its device is given another, then moves to the
+ * new one and starts its chains afresh there.
+ */
+static struct _stoch_model *stoch_file_model( struct _stoch_file *f ) {
+	struct _stoch_model *m;
+
+	if (likely( rcu_access_pointer( f->dev->model ) == f->model )) {
+		return f->model;
+	}
+
+	m = stoch_dev_model( f->dev );
+	if (m->rng != f->model->rng) {
+		stoch_rng_init( &f->chain.rng, m->rng );
+	}
+	f->chain.started = 0;
+	f->prev = 0;
+	stoch_model_put( f->model );
+	f->model = m;
+
+	return m;
+}
+
+// a mapping holds the model whose tables it maps, even once the device has another
+static void stoch_vma_open( struct vm_area_struct *vma ) {
+	struct _stoch_model *m = vma->vm_private_data;
+
+	kref_get( &m->ref );
+	atomic_inc( &m->mapped );
+}
+
+static void stoch_vma_close( struct vm_area_struct *vma ) {
+	struct _stoch_model *m = vma->vm_private_data;
+
+	atomic_dec( &m->mapped );
+	stoch_model_put( m );
+}
+
+static const struct vm_operations_struct stoch_vm_ops = {
+  open: stoch_vma_open,
+  close: stoch_vma_close
+};
+
+// map the order 0 or 1 sampling tables read-only, see stochdev.h
+static int stoch_mmap(struct file *filp, struct vm_area_struct *vma) {
+	struct _stoch_file *f = filp->private_data;
+	struct _stoch_model *m;
+	int result;
+
+	// not f->model, that needs f->lock, which is taken with mmap_lock held the other way round
+	m = stoch_dev_model( f->dev );
+	result = stoch_map_mmap( m->map, vma );
+	if (result < 0) {
+		stoch_model_put( m );
+		return result;
+	}
+	vma->vm_private_data = m;
+	vma->vm_ops = &stoch_vm_ops;
+
+	// from now on writes keep the tables up to date, and the window's periods
+	atomic_inc( &m->mapped );
+	if (m->mode == STOCH_MODE_WINDOW) {
+		queue_delayed_work( system_wq, &m->map_work, 0 );
+	}
+
+	return 0;
+}
+
+// create, destroy, describe, reset, swap and benchmark models, see stochdev.h
+static long stoch_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+	struct _stoch_file *f = filp->private_data;
+	void __user *argp = (void __user *)arg;
+	struct stoch_model_conf conf;
+	struct stoch_bench bench;
+	struct _stoch_model *m;
+	struct _stoch_dev *d;
+	__u32 minor, frozen;
+	int result;
+
+	switch (cmd) {
+	case STOCH_IOC_CREATE:
+		if (!capable( CAP_SYS_ADMIN )) {
+			return -EPERM;
+		}
+		if (copy_from_user( &conf, argp, sizeof(conf) )) {
+			return -EFAULT;
+		}
+		d = stoch_dev_create( &conf );
+		if (IS_ERR( d )) {
+			return PTR_ERR( d );
+		}
+		conf.minor = d->minor;
+		if (copy_to_user( argp, &conf, sizeof(conf) )) {
+			// nobody would know which model this was
+			stoch_dev_destroy( conf.minor );
+			return -EFAULT;
+		}
+		return 0;
+
+	case STOCH_IOC_DESTROY:
+		if (!capable( CAP_SYS_ADMIN )) {
+			return -EPERM;
+		}
+		if (get_user( minor, (__u32 __user *)argp )) {
+			return -EFAULT;
+		}
+		return stoch_dev_destroy( minor );
+
+	case STOCH_IOC_GETCONF:
+		m = stoch_dev_model( f->dev );
+		stoch_model_conf( m, &conf );
+		stoch_model_put( m );
+		conf.minor = f->dev->minor;
+		if (copy_to_user( argp, &conf, sizeof(conf) )) {
+			return -EFAULT;
+		}
+		return 0;
+
+	case STOCH_IOC_CLEAR:
+		// as much a change to the model as a write
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			return -EBADF;
+		}
+		return stoch_dev_clear( f->dev );
+
+	case STOCH_IOC_FREEZE:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			return -EBADF;
+		}
+		if (get_user( frozen, (__u32 __user *)argp )) {
+			return -EFAULT;
+		}
+		m = stoch_dev_model( f->dev );
+		WRITE_ONCE( m->frozen, frozen != 0 );
+		stoch_model_put( m );
+		return 0;
+
+	case STOCH_IOC_SWAP:
+		if (!capable( CAP_SYS_ADMIN )) {
+			return -EPERM;
+		}
+		if (get_user( minor, (__u32 __user *)argp )) {
+			return -EFAULT;
+		}
+		return stoch_dev_swap( f->dev, minor );
+
+	case STOCH_IOC_BENCH:
+		if (copy_from_user( &bench, argp, sizeof(bench) )) {
+			return -EFAULT;
+		}
+		m = stoch_dev_model( f->dev );
+		result = stoch_bench_run( f, m, &bench );
+		stoch_model_put( m );
+		if (result < 0) {
+			return result;
+		}
+		if (copy_to_user( argp, &bench, sizeof(bench) )) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	return -ENOTTY;
+}
+
+// continue the file's chain into buff, stopping early if a 0 is generated
+static size_t stoch_file_gen( struct _stoch_file *f, unsigned char *buff, size_t size ) {
+	switch (f->model->engine) {
+	case STOCH_ENGINE_DENSE:
+		return stoch_hist_gen( f->model, &f->chain, buff, size );
+	case STOCH_ENGINE_FENWICK:
+		return stoch_fen_gen( f->model, &f->chain, buff, size );
+	default:
+		return stoch_ctx_gen( f->model, &f->chain, buff, size );
+	}
+}
+
+/*
+ * Generate random output from the histogram. Kernel pages, which is what
+ * splice passes us through copy_splice_read, are generated into directly.
+ * User buffers are generated a chunk at a time into the scratch page and
+ * copied out, a chunk spanning as many iovecs as it covers.
+ */
+static ssize_t stoch_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+	struct _stoch_file *f = iocb->ki_filp->private_data;
+	struct _stoch_model *m;
+	size_t done, n, pos, c;
+	unsigned char *p;
+	ssize_t result = 0;
+
+	if (mutex_lock_interruptible( &f->lock )) {
+		return -ERESTARTSYS;
+	}
+	m = stoch_file_model( f );
+
+	if (m->engine == STOCH_ENGINE_DENSE) {
+		stoch_hists_refresh( m );
+	}
+
+	done = 0;
+	while (iov_iter_count( to ) > 0) {
+		n = min_t( size_t, iov_iter_count( to ), STOCH_CHUNK_SIZE );
+		p = stoch_iter_map( to, &n );
+		if (p) {
+			pos = stoch_file_gen( f, p, n );
+			stoch_iter_unmap( to, p );
+			iov_iter_advance( to, pos );
+		} else {
+			pos = stoch_file_gen( f, f->buf, n );
+			c = copy_to_iter( f->buf, pos, to );
+			if (c != pos) {
+				done += c;
+				result = -EFAULT;
+				break;
+			}
+		}
+		done += pos;
+
+		// a generated 0 ends the output
+		if (pos < n) {
+			break;
+		}
+
+		if (signal_pending( current )) {
+			result = -ERESTARTSYS;
+			break;
+		}
+		cond_resched();
+	}
+
+	mutex_unlock( &f->lock );
+
+	return done ? done : result;
+}
+
+// count buff into the model, carrying on from the file's last write; returns the bytes counted
+static ssize_t stoch_file_train( struct _stoch_file *f, const unsigned char *buff, size_t size ) {
+	switch (f->model->engine) {
+	case STOCH_ENGINE_DENSE:
+		return stoch_hist_train( f->model, &f->prev, buff, size );
+	case STOCH_ENGINE_FENWICK:
+		f->prev = stoch_fen_train( f->model, f->prev, buff, size );
+		break;
+	default:
+		return stoch_ctx_train( f->model, &f->prev, buff, size );
+	}
+
+	return size;
+}
+
+/*
+ * Populate the histogram. Kernel pages, such as the pipe pages
+ * iter_file_splice_write passes when a file or pipe is spliced to the
+ * device, are counted where they are. User buffers are copied in a chunk
+ * at a time through the scratch page.
+ */
+static ssize_t stoch_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+	struct _stoch_file *f = iocb->ki_filp->private_data;
+	struct _stoch_model *m;
+	size_t done, n;
+	unsigned char *p;
+	ssize_t c, result = 0;
+
+	if (mutex_lock_interruptible( &f->lock )) {
+		return -ERESTARTSYS;
+	}
+	m = stoch_file_model( f );
+	if (READ_ONCE( m->frozen )) {
+		mutex_unlock( &f->lock );
+		return -EROFS;
+	}
+
+	done = 0;
+	while (iov_iter_count( from ) > 0) {
+		n = min_t( size_t, iov_iter_count( from ), STOCH_CHUNK_SIZE );
+		p = stoch_iter_map( from, &n );
+		if (p) {
+			c = stoch_file_train( f, p, n );
+			stoch_iter_unmap( from, p );
+			if (c > 0) {
+				iov_iter_advance( from, c );
+			}
+		} else {
+			n = copy_from_iter( f->buf, n, from );
+			if (n == 0) {
+				result = -EFAULT;
+				break;
+			}
+			c = stoch_file_train( f, f->buf, n );
+		}
+		if (c < 0) {
+			result = c;
+			break;
+		}
+		done += c;
+
+		// only what was counted is reported written, so a retry counts the rest once
+		if (c < n) {
+			result = -ENOMEM;
+			break;
+		}
+
+		if (signal_pending( current )) {
+			result = -ERESTARTSYS;
+			break;
+		}
+		cond_resched();
+	}
+
+	// a failed chunk may still have counted some of its blocks
+	if ((done || result < 0) && m->engine == STOCH_ENGINE_DENSE) {
+		if (!atomic_read( &m->stale )) {
+			atomic_set( &m->stale, 1 );
+		}
+		// a mapping may be all there is reading the model
+		if (atomic_read( &m->mapped )) {
+			queue_delayed_work( system_wq, &m->map_work, msecs_to_jiffies( STOCH_MAP_LAG_MS ) );
+		}
+	}
+
+	// m is only ours while we hold the lock
+	mutex_unlock( &f->lock );
+
+	return done ? done : result;
+}
+
+module_init(stoch_init);
+module_exit(stoch_exit);
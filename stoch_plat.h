@@ -0,0 +1,101 @@
+/*
+ * What the stoch core (stoch.h, stoch_core.c) needs from the environment
+ * it is built for. In the module this is the kernel headers and the hooks
+ * in stoch_mod.c; in userspace (libstoch.a) libc and stoch_user.c.
+ */
+
+#ifndef STOCH_PLAT_H
+#define STOCH_PLAT_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/cache.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/prefetch.h>
+#include <linux/math64.h>
+#include <asm/barrier.h>
+
+// start a structure or member on a cache line of its own
+#define STOCH_CACHE_ALIGNED ____cacheline_aligned
+
+// load a pointer published under RCU, the caller holds rcu_read_lock
+#define stoch_deref( p ) rcu_dereference( p )
+
+// load a pointer published under RCU from the side that publishes it, the caller serializes
+#define stoch_deref_writer( p ) rcu_dereference_protected( p, 1 )
+
+// publish v in p for readers under RCU
+#define stoch_publish( p, v ) rcu_assign_pointer( p, v )
+
+// free p from stoch_plat_zalloc once no reader can see it, p has a struct rcu_head rcu
+#define stoch_retire( p ) kvfree_rcu( p, rcu )
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __rcu
+#define STOCH_CACHE_ALIGNED __attribute__((aligned(64)))
+#define stoch_deref( p ) (p)
+#define stoch_deref_writer( p ) (p)
+#define stoch_publish( p, v ) ((p) = (v))
+
+// a reader on another thread would need RCU, the users of libstoch.a have none
+#define stoch_retire( p ) stoch_plat_free( p )
+#define READ_ONCE( x ) (x)
+#define WRITE_ONCE( x, v ) ((x) = (v))
+#define smp_wmb() __atomic_thread_fence( __ATOMIC_RELEASE )
+#define smp_rmb() __atomic_thread_fence( __ATOMIC_ACQUIRE )
+#define prefetch( x ) __builtin_prefetch( x )
+
+// only there so structures keep the layout the module gives them
+struct rcu_head {
+	void *next;
+};
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE( a ) (sizeof(a) / sizeof((a)[0]))
+#endif
+#define BITS_PER_LONG ((int)(8 * sizeof(long)))
+#define min_t( type, a, b ) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+
+static inline u64 rol64( u64 word, unsigned int shift ) {
+	return (word << shift) | (word >> (64 - shift));
+}
+
+static inline u64 mul_u64_u64_shr( u64 a, u64 b, unsigned int shift ) {
+	return (u64)(((unsigned __int128)a * b) >> shift);
+}
+
+// the kernel's multiplicative hash
+static inline u32 hash_64( u64 val, unsigned int bits ) {
+	return (u32)((val * 0x61c8864680b583ebULL) >> (64 - bits));
+}
+
+#endif
+
+/* supplied by the environment */
+void stoch_plat_random( void *buf, size_t size ); // cryptographic quality random bytes
+void stoch_plat_seed( u64 s[4] ); // a fresh, non-zero xoshiro256** state
+void *stoch_plat_zalloc( size_t size ); // zeroed memory, NULL if there is none; may sleep
+void stoch_plat_free( void *p ); // memory from stoch_plat_zalloc, NULL is ignored
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Userspace environment for the stoch core, the stoch_plat.h hooks the
+ * module otherwise provides. Built into libstoch.a with stoch_core.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/random.h>
+
+#include "stoch.h"
+
+// fall back to the device when getrandom is not available
+static void stoch_user_urandom( unsigned char *p, size_t size ) {
+	ssize_t n;
+	int fd;
+
+	fd = open( "/dev/urandom", O_RDONLY );
+	if (fd < 0) {
+		perror( "stoch: /dev/urandom" );
+		abort();
+	}
+	while (size > 0) {
+		n = read( fd, p, size );
+		if (n <= 0) {
+			perror( "stoch: /dev/urandom" );
+			abort();
+		}
+		p += n;
+		size -= n;
+	}
+	close( fd );
+}
+
+void stoch_plat_random( void *buf, size_t size ) {
+	unsigned char *p = buf;
+	ssize_t n;
+
+	while (size > 0) {
+		n = getrandom( p, size, 0 );
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			stoch_user_urandom( p, size );
+			return;
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+void stoch_plat_seed( u64 s[4] ) {
+	do {
+		stoch_plat_random( s, 4 * sizeof(s[0]) );
+	} while ((s[0] | s[1] | s[2] | s[3]) == 0);
+}
+
+void *stoch_plat_zalloc( size_t size ) {
+	return calloc( 1, size );
+}
+
+void stoch_plat_free( void *p ) {
+	free( p );
+}
@@ -0,0 +1,233 @@
+/*
+ * Concurrent writer benchmark for /dev/stoch.
+ * Runs 1, 2, 4, ... up to the requested number of threads, each writing the
+ * same buffer to the device in a loop, and reports the aggregate training
+ * throughput for every thread count.
+ *
+ * With -k it instead has the driver time its own sampling and training
+ * loops (STOCH_IOC_BENCH, see stochdev.h) for every distribution and
+ * sampler, which leaves out the syscall and copy overhead.
+ *
+ * $ make stochbench
+ * $ ./stochbench [-d /dev/stoch] [-t threads] [-s seconds] [-b bufsize]
+ * $ ./stochbench -k [-d /dev/stoch] [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "stochdev.h"
+
+struct bench_thread {
+	pthread_t thread;
+	const char *path;
+	const unsigned char *buf;
+	size_t size;
+	double seconds;
+	unsigned long long bytes;
+	int err;
+};
+
+static double bench_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *bench_writer( void *arg ) {
+	struct bench_thread *t = arg;
+	double end;
+	ssize_t n;
+	int fd;
+
+	fd = open( t->path, O_WRONLY );
+	if (fd < 0) {
+		t->err = 1;
+		return NULL;
+	}
+
+	end = bench_now() + t->seconds;
+	while (bench_now() < end) {
+		n = write( fd, t->buf, t->size );
+		if (n < 0) {
+			t->err = 1;
+			break;
+		}
+		t->bytes += n;
+	}
+
+	close( fd );
+	return NULL;
+}
+
+// fill the buffer with text-like data so the rows see realistic repetition
+static void bench_fill( unsigned char *buf, size_t size ) {
+	static const char *words[] = { "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ", "hello ", "\n" };
+	size_t i, j, n;
+	const char *w;
+
+	srand( 1 );
+	i = 0;
+	while (i < size) {
+		w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		n = strlen( w );
+		for (j = 0; j < n && i < size; j++) {
+			buf[i++] = w[j];
+		}
+	}
+}
+
+static void usage( void ) {
+	printf( "Usage: stochbench [-d device] [-t threads] [-s seconds] [-b bufsize]\n"
+		"       stochbench -k [-d device] [-n iterations]\n" );
+	exit( 1 );
+}
+
+static int bench_ioctl( int fd, struct stoch_bench *b, const char *dist, const char *op, const char *sampler ) {
+	if (ioctl( fd, STOCH_IOC_BENCH, b ) < 0) {
+		// an untrained model has nothing to sample
+		printf( "%8s %8s %8s %12s\n", dist, op, sampler, "-" );
+		return -1;
+	}
+	printf( "%8s %8s %8s %12.2f %12.2f\n", dist, op, sampler,
+		(double)b->ns / b->iters, (double)b->cycles / b->iters );
+	return 0;
+}
+
+// time the in-kernel hot paths for every distribution and sampler
+static int bench_kernel( const char *path, unsigned long long iters ) {
+	static const char *dists[] = { "live", "uniform", "zipf", "single" };
+	static const char *samplers[] = { "scan", "alias", "cdf", "fenwick" };
+	struct stoch_bench b;
+	int fd, d, s;
+
+	fd = open( path, O_RDONLY );
+	if (fd < 0) {
+		perror( path );
+		return 1;
+	}
+
+	printf( "%8s %8s %8s %12s %12s\n", "dist", "op", "sampler", "ns/op", "cycles/op" );
+	for (d = STOCH_BENCH_LIVE; d <= STOCH_BENCH_SINGLE; d++) {
+		for (s = STOCH_SAMPLER_SCAN; s <= STOCH_SAMPLER_FENWICK; s++) {
+			memset( &b, 0, sizeof(b) );
+			b.dist = d;
+			b.op = STOCH_BENCH_SAMPLE;
+			b.sampler = s;
+			b.iters = iters;
+			bench_ioctl( fd, &b, dists[d], "sample", samplers[s] );
+		}
+
+		memset( &b, 0, sizeof(b) );
+		b.dist = d;
+		b.op = STOCH_BENCH_TRAIN;
+		b.iters = iters;
+		bench_ioctl( fd, &b, dists[d], "train", "-" );
+	}
+
+	close( fd );
+	return 0;
+}
+
+int main( int argc, char **argv ) {
+	const char *path = "/dev/stoch";
+	int maxthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	double seconds = 2.0;
+	size_t size = 64 * 1024;
+	unsigned long long iters = 10000000;
+	int kernel = 0;
+	struct bench_thread *t;
+	unsigned char *buf;
+	unsigned long long bytes;
+	double start, elapsed, base;
+	int i, n, opt;
+
+	while ((opt = getopt( argc, argv, "d:t:s:b:kn:h" )) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 't':
+			maxthreads = atoi( optarg );
+			break;
+		case 's':
+			seconds = atof( optarg );
+			break;
+		case 'b':
+			size = strtoul( optarg, NULL, 0 );
+			break;
+		case 'k':
+			kernel = 1;
+			break;
+		case 'n':
+			iters = strtoull( optarg, NULL, 0 );
+			break;
+		default:
+			usage();
+		}
+	}
+	if (maxthreads < 1 || size == 0 || seconds <= 0 || iters == 0) {
+		usage();
+	}
+
+	if (kernel) {
+		return bench_kernel( path, iters );
+	}
+
+	buf = malloc( size );
+	t = calloc( maxthreads, sizeof(*t) );
+	if (!buf || !t) {
+		perror( "malloc" );
+		return 1;
+	}
+	bench_fill( buf, size );
+
+	printf( "%8s %12s %12s %8s\n", "threads", "MB/s", "MB/s/thread", "scaling" );
+	base = 0;
+	for (n = 1; n <= maxthreads; n = (n * 2 < maxthreads) ? n * 2 : maxthreads) {
+		memset( t, 0, maxthreads * sizeof(*t) );
+
+		start = bench_now();
+		for (i = 0; i < n; i++) {
+			t[i].path = path;
+			t[i].buf = buf;
+			t[i].size = size;
+			t[i].seconds = seconds;
+			pthread_create( &t[i].thread, NULL, bench_writer, &t[i] );
+		}
+
+		bytes = 0;
+		for (i = 0; i < n; i++) {
+			pthread_join( t[i].thread, NULL );
+			if (t[i].err) {
+				fprintf( stderr, "stochbench: cannot write %s\n", path );
+				return 1;
+			}
+			bytes += t[i].bytes;
+		}
+		elapsed = bench_now() - start;
+
+		if (n == 1) {
+			base = bytes / elapsed;
+		}
+		printf( "%8d %12.1f %12.1f %7.2fx\n", n,
+			bytes / elapsed / 1e6, bytes / elapsed / 1e6 / n,
+			base > 0 ? bytes / elapsed / base : 0.0 );
+
+		if (n == maxthreads) {
+			break;
+		}
+	}
+
+	free( t );
+	free( buf );
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Create, destroy and inspect stoch models, see stochdev.h.
+ *
+ * $ make stochctl
+ * $ ./stochctl create [-o order] [-s alias|cdf|fenwick|scan] [-r fast|crypto]
+ *                    [-m accumulate|decay|window] [-p period_ms] [-w periods]
+ * $ ./stochctl destroy minor
+ * $ ./stochctl info [device]
+ * $ ./stochctl shadow [device]
+ * $ ./stochctl swap device minor
+ * $ ./stochctl clear|freeze|thaw [device]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "stochdev.h"
+
+static const char *sampler_names[] = { "scan", "alias", "cdf", "fenwick" };
+static const char *rng_names[] = { "crypto", "fast" };
+static const char *mode_names[] = { "accumulate", "decay", "window" };
+
+#define ARRAY_SIZE( a ) (sizeof(a) / sizeof((a)[0]))
+
+static int name_index( const char **names, int n, const char *name ) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (strcmp( names[i], name ) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void usage( void ) {
+	printf( "Usage: stochctl create [-o order] [-s alias|cdf|fenwick|scan] [-r fast|crypto]\n"
+		"                       [-m accumulate|decay|window] [-p period_ms] [-w periods]\n"
+		"       stochctl destroy minor\n"
+		"       stochctl info [device]\n"
+		"       stochctl shadow [device]\n"
+		"       stochctl swap device minor\n"
+		"       stochctl clear|freeze|thaw [device]\n" );
+	exit( 1 );
+}
+
+static int ctl_open( const char *path, int flags ) {
+	int fd;
+
+	fd = open( path, flags );
+	if (fd < 0) {
+		perror( path );
+		exit( 1 );
+	}
+	return fd;
+}
+
+static int ctl_create( int argc, char **argv ) {
+	struct stoch_model_conf conf;
+	int fd, opt;
+
+	memset( &conf, 0, sizeof(conf) );
+	conf.sampler = STOCH_SAMPLER_ALIAS;
+	conf.rng = STOCH_RNG_FAST;
+	conf.mode = STOCH_MODE_ACCUMULATE;
+	conf.period = 1000;
+	conf.epochs = 8;
+
+	while ((opt = getopt( argc, argv, "o:s:r:m:p:w:" )) != -1) {
+		switch (opt) {
+		case 'o':
+			conf.order = atoi( optarg );
+			break;
+		case 's':
+			opt = name_index( sampler_names, ARRAY_SIZE(sampler_names), optarg );
+			if (opt < 0) {
+				usage();
+			}
+			conf.sampler = opt;
+			break;
+		case 'r':
+			opt = name_index( rng_names, ARRAY_SIZE(rng_names), optarg );
+			if (opt < 0) {
+				usage();
+			}
+			conf.rng = opt;
+			break;
+		case 'm':
+			opt = name_index( mode_names, ARRAY_SIZE(mode_names), optarg );
+			if (opt < 0) {
+				usage();
+			}
+			conf.mode = opt;
+			break;
+		case 'p':
+			conf.period = atoi( optarg );
+			break;
+		case 'w':
+			conf.epochs = atoi( optarg );
+			break;
+		default:
+			usage();
+		}
+	}
+
+	fd = ctl_open( "/dev/stoch", O_RDONLY );
+	if (ioctl( fd, STOCH_IOC_CREATE, &conf ) < 0) {
+		perror( "stochctl: create" );
+		return 1;
+	}
+	close( fd );
+
+	printf( "/dev/stoch%u\n", conf.minor );
+	return 0;
+}
+
+static int ctl_destroy( const char *arg ) {
+	__u32 minor;
+	int fd;
+
+	minor = strtoul( arg, NULL, 0 );
+	fd = ctl_open( "/dev/stoch", O_RDONLY );
+	if (ioctl( fd, STOCH_IOC_DESTROY, &minor ) < 0) {
+		perror( "stochctl: destroy" );
+		return 1;
+	}
+	close( fd );
+
+	return 0;
+}
+
+static int ctl_info( const char *path ) {
+	struct stoch_model_conf conf;
+	int fd;
+
+	fd = ctl_open( path, O_RDONLY );
+	if (ioctl( fd, STOCH_IOC_GETCONF, &conf ) < 0) {
+		perror( "stochctl: info" );
+		return 1;
+	}
+	close( fd );
+
+	printf( "minor %u order %u sampler %s rng %s\n", conf.minor, conf.order,
+		conf.sampler < ARRAY_SIZE(sampler_names) ? sampler_names[conf.sampler] : "?",
+		conf.rng < ARRAY_SIZE(rng_names) ? rng_names[conf.rng] : "?" );
+	printf( "mode %s", conf.mode < ARRAY_SIZE(mode_names) ? mode_names[conf.mode] : "?" );
+	if (conf.mode != STOCH_MODE_ACCUMULATE) {
+		printf( " period %ums", conf.period );
+	}
+	if (conf.mode == STOCH_MODE_WINDOW) {
+		printf( " window %u", conf.epochs );
+	}
+	if (conf.flags & STOCH_CONF_FROZEN) {
+		printf( " frozen" );
+	}
+	printf( "\n" );
+	return 0;
+}
+
+// create an untrained model with the same settings as path's, to train and swap in
+static int ctl_shadow( const char *path ) {
+	struct stoch_model_conf conf;
+	int fd;
+
+	fd = ctl_open( path, O_RDONLY );
+	if (ioctl( fd, STOCH_IOC_GETCONF, &conf ) < 0 || ioctl( fd, STOCH_IOC_CREATE, &conf ) < 0) {
+		perror( "stochctl: shadow" );
+		return 1;
+	}
+	close( fd );
+
+	printf( "/dev/stoch%u\n", conf.minor );
+	return 0;
+}
+
+static int ctl_swap( const char *path, const char *arg ) {
+	__u32 minor;
+	int fd;
+
+	minor = strtoul( arg, NULL, 0 );
+	fd = ctl_open( path, O_RDONLY );
+	if (ioctl( fd, STOCH_IOC_SWAP, &minor ) < 0) {
+		perror( "stochctl: swap" );
+		return 1;
+	}
+	close( fd );
+
+	return 0;
+}
+
+// clear, freeze or thaw the model of path
+static int ctl_reset( const char *cmd, const char *path ) {
+	__u32 frozen;
+	int fd, result;
+
+	fd = ctl_open( path, O_WRONLY );
+	if (strcmp( cmd, "clear" ) == 0) {
+		result = ioctl( fd, STOCH_IOC_CLEAR );
+	} else {
+		frozen = (strcmp( cmd, "freeze" ) == 0);
+		result = ioctl( fd, STOCH_IOC_FREEZE, &frozen );
+	}
+	if (result < 0) {
+		fprintf( stderr, "stochctl: %s: %s\n", cmd, strerror( errno ) );
+		return 1;
+	}
+	close( fd );
+
+	return 0;
+}
+
+int main( int argc, char **argv ) {
+	if (argc < 2) {
+		usage();
+	}
+
+	if (strcmp( argv[1], "create" ) == 0) {
+		return ctl_create( argc - 1, argv + 1 );
+	}
+	if (strcmp( argv[1], "destroy" ) == 0 && argc == 3) {
+		return ctl_destroy( argv[2] );
+	}
+	if (strcmp( argv[1], "info" ) == 0) {
+		return ctl_info( argc > 2 ? argv[2] : "/dev/stoch" );
+	}
+	if (strcmp( argv[1], "shadow" ) == 0) {
+		return ctl_shadow( argc > 2 ? argv[2] : "/dev/stoch" );
+	}
+	if (strcmp( argv[1], "swap" ) == 0 && argc == 4) {
+		return ctl_swap( argv[2], argv[3] );
+	}
+	if (strcmp( argv[1], "clear" ) == 0 || strcmp( argv[1], "freeze" ) == 0 || strcmp( argv[1], "thaw" ) == 0) {
+		return ctl_reset( argv[1], argc > 2 ? argv[2] : "/dev/stoch" );
+	}
+	usage();
+
+	return 1;
+}
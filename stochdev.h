@@ -0,0 +1,167 @@
+/*
+ * Userspace interface to the stoch devices, shared by the drivers and the
+ * userspace tools.
+ */
+
+#ifndef STOCHDEV_H
+#define STOCHDEV_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* ------- models --------------- */
+
+/*
+ * Every minor number is an independent model with its own training data
+ * and settings. Minor 0, /dev/stoch, is created from the module parameters
+ * when the module loads. Further models are created and destroyed with
+ * ioctls on any stoch device (CAP_SYS_ADMIN required) and appear as
+ * /dev/stochN where N is the minor number.
+ */
+
+/* sampling algorithms */
+#define STOCH_SAMPLER_SCAN  0 /* linear walk over the bins, most frequent first */
+#define STOCH_SAMPLER_ALIAS 1 /* Walker/Vose alias table */
+#define STOCH_SAMPLER_CDF   2 /* binary search of the cumulative counts */
+#define STOCH_SAMPLER_FENWICK 3 /* Fenwick trees trained and sampled in place, orders 0 and 1 */
+
+/* random number sources */
+#define STOCH_RNG_CRYPTO 0 /* get_random_bytes, one call per batch */
+#define STOCH_RNG_FAST   1 /* xoshiro256** seeded from get_random_bytes */
+
+#define STOCH_ORDER_MAX 8
+
+/*
+ * How training data ages. By default every byte ever written counts the
+ * same. Decay halves the weight of what was written every period, so the
+ * model follows recent data while older data fades out. Window only
+ * counts what was written in the last epochs periods and forgets anything
+ * older all at once. Both are for orders 0 and 1 with the scan, alias and
+ * cdf samplers.
+ */
+#define STOCH_MODE_ACCUMULATE 0
+#define STOCH_MODE_DECAY      1
+#define STOCH_MODE_WINDOW     2
+
+#define STOCH_WINDOW_MAX 16 /* most periods a window can span */
+
+struct stoch_model_conf {
+	__u32 minor;   /* filled in by STOCH_IOC_CREATE */
+	__u32 order;   /* previous bytes each byte depends on, 0 to STOCH_ORDER_MAX */
+	__u32 sampler; /* STOCH_SAMPLER_ */
+	__u32 rng;     /* STOCH_RNG_ */
+	__u32 mode;    /* STOCH_MODE_ */
+	__u32 period;  /* decay half-life or window period in milliseconds, unless accumulating */
+	__u32 epochs;  /* periods in the window, 1 to STOCH_WINDOW_MAX, for STOCH_MODE_WINDOW */
+	__u32 flags;   /* STOCH_CONF_, filled in by STOCH_IOC_GETCONF */
+};
+
+#define STOCH_CONF_FROZEN 0x1 /* see STOCH_IOC_FREEZE */
+
+#define STOCH_IOC_MAGIC 0xb7
+
+#define STOCH_IOC_CREATE  _IOWR(STOCH_IOC_MAGIC, 1, struct stoch_model_conf)
+#define STOCH_IOC_DESTROY _IOW(STOCH_IOC_MAGIC, 2, __u32) /* minor, 0 cannot be destroyed */
+#define STOCH_IOC_GETCONF _IOR(STOCH_IOC_MAGIC, 3, struct stoch_model_conf)
+
+/*
+ * Resetting and replacing a device's model without reloading the module.
+ * Files open on the device stay open: each moves to the device's new model
+ * on its next read or write and starts its chains over, and a read already
+ * in progress finishes on the old one. Existing mappings keep showing the
+ * model they were made from, map the device again to see the new one.
+ *
+ * STOCH_IOC_CLEAR gives the device a new, untrained model with the same
+ * settings, still frozen if the old one was. STOCH_IOC_FREEZE with a
+ * non-zero argument makes writes to the model fail with EROFS and 0
+ * allows them again; decay and window models still age while frozen.
+ * Both need the file open for writing.
+ *
+ * STOCH_IOC_SWAP exchanges the device's model with the model of the given
+ * minor, and needs CAP_SYS_ADMIN. To retrain without disturbing readers,
+ * create a shadow model, train it, swap it in and destroy the shadow,
+ * which then holds the old model (or swap back to roll back).
+ */
+#define STOCH_IOC_CLEAR   _IO(STOCH_IOC_MAGIC, 5)
+#define STOCH_IOC_FREEZE  _IOW(STOCH_IOC_MAGIC, 6, __u32)
+#define STOCH_IOC_SWAP    _IOW(STOCH_IOC_MAGIC, 7, __u32) /* minor */
+
+/* ------- benchmark --------------- */
+
+/*
+ * STOCH_IOC_BENCH times the sampling and training hot paths inside the
+ * kernel, without syscall or copy overhead. It runs iters operations
+ * against the model behind the file or against a synthetic distribution
+ * and returns the total time taken.
+ *
+ * STOCH_BENCH_SAMPLE draws a chain of values, each the context of the
+ * next, with the given sampler. On the live model a generated 0 restarts
+ * the chain. Orders above 1 always sample their sparse rows by scanning,
+ * fenwick models always sample their trees, and the live rows of other
+ * order 0 and 1 models only hold the table of the model's own sampler, so
+ * any other sampler is refused there (EINVAL). A synthetic distribution
+ * is built privately for whichever sampler is asked for.
+ * STOCH_BENCH_TRAIN counts values drawn from the distribution into a
+ * private table like the model's own: rows of order 0 or 1, trees for a
+ * fenwick model and a table of contexts of the model's order above 1, so
+ * the live model is never changed.
+ *
+ * The synthetic distributions cover the symbols 1-255 so chains never end.
+ */
+#define STOCH_BENCH_LIVE    0 /* the model itself */
+#define STOCH_BENCH_UNIFORM 1 /* every symbol equally likely */
+#define STOCH_BENCH_ZIPF    2 /* symbol i weighted 1/i */
+#define STOCH_BENCH_SINGLE  3 /* always the same symbol */
+
+#define STOCH_BENCH_SAMPLE 0
+#define STOCH_BENCH_TRAIN  1
+
+struct stoch_bench {
+	__u32 dist;    /* STOCH_BENCH_LIVE etc. */
+	__u32 op;      /* STOCH_BENCH_SAMPLE or STOCH_BENCH_TRAIN */
+	__u32 sampler; /* STOCH_SAMPLER_, for STOCH_BENCH_SAMPLE */
+	__u32 pad;
+	__u64 iters;
+	__u64 ns;      /* out: total time */
+	__u64 cycles;  /* out: total cycle counter ticks, 0 where there is none */
+};
+
+#define STOCH_IOC_BENCH _IOWR(STOCH_IOC_MAGIC, 4, struct stoch_bench)
+
+/* ------- mmap --------------- */
+
+/*
+ * Mapping a non-fenwick order 0 or 1 device read-only gives a struct
+ * stoch_map holding a copy of the live sampling tables. Each table is an
+ * alias table: pick a slot i uniformly from 0..255, draw u uniformly from
+ * [0, total) and return i if u < prob[i], otherwise alias[i]. A table
+ * with total 0 has no data. These are the exact tables; the driver itself
+ * samples from a copy quantized to 16 bits. Fenwick models cannot be
+ * mapped (ENODEV).
+ *
+ * While the device is mapped the driver rebuilds the copy within about
+ * 10 ms of each write, and at every period of a window model, so clients
+ * that never read still see training.
+ *
+ * seq is odd while the driver is updating the tables. A reader takes seq,
+ * samples, and retries if seq was odd or has changed since.
+ */
+#define STOCH_MAP_MAGIC   0x53544f43 /* "STOC" */
+#define STOCH_MAP_VERSION 1
+
+struct stoch_map_table {
+	__u32 total;
+	__u32 prob[256];
+	__u8 alias[256];
+};
+
+struct stoch_map {
+	__u32 magic;
+	__u32 version;
+	__u32 seq;
+	__u32 nrows; /* 1 at order 0, 256 at order 1 where row i follows byte i */
+	struct stoch_map_table start; /* start-state distribution */
+	struct stoch_map_table rows[];
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Userspace sampling from a memory mapped stoch device, see stochmap.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "stochmap.h"
+
+static inline uint64_t rotl( uint64_t x, int k ) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t stochmap_rand( struct stochmap *m ) {
+	uint64_t *s = m->rng;
+	uint64_t result, t;
+
+	result = rotl( s[1] * 5, 7 ) * 9;
+	t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl( s[3], 45 );
+
+	return result;
+}
+
+static void stochmap_seed( struct stochmap *m ) {
+	do {
+		if (getrandom( m->rng, sizeof(m->rng), 0 ) != sizeof(m->rng)) {
+			// no getrandom, fall back to something that at least differs per process
+			m->rng[0] = (uintptr_t)m ^ ((uint64_t)getpid() << 32);
+			m->rng[1] = 0x9e3779b97f4a7c15ULL;
+			m->rng[2] = (uint64_t)time( NULL );
+			m->rng[3] = 1;
+		}
+	} while ((m->rng[0] | m->rng[1] | m->rng[2] | m->rng[3]) == 0);
+}
+
+/*
+ * Draw from one table of the map. Retries with the same random word until
+ * the sequence count shows no update happened while the table was read.
+ * Returns -1 if the table has no data.
+ */
+static int stochmap_val( const struct stoch_map *map, const struct stoch_map_table *t, uint64_t r ) {
+	uint32_t seq, total, slot, u;
+	int val;
+
+	do {
+		while ((seq = __atomic_load_n( &map->seq, __ATOMIC_ACQUIRE )) & 1) {
+			// the driver is mid update
+		}
+
+		total = __atomic_load_n( &t->total, __ATOMIC_RELAXED );
+		if (total == 0) {
+			val = -1;
+		} else {
+			slot = (uint32_t)r & 255;
+			u = (uint32_t)(((r >> 32) * total) >> 32);
+			val = (u < __atomic_load_n( &t->prob[slot], __ATOMIC_RELAXED )) ?
+				(int)slot : __atomic_load_n( &t->alias[slot], __ATOMIC_RELAXED );
+		}
+
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	} while (__atomic_load_n( &map->seq, __ATOMIC_RELAXED ) != seq);
+
+	return val;
+}
+
+int stochmap_open( struct stochmap *m, const char *path ) {
+	struct stoch_map hdr;
+	void *p;
+	int err;
+
+	memset( m, 0, sizeof(*m) );
+	m->fd = open( path, O_RDONLY );
+	if (m->fd < 0) {
+		return -1;
+	}
+
+	// map the header first to learn how many tables follow
+	p = mmap( NULL, sizeof(hdr), PROT_READ, MAP_SHARED, m->fd, 0 );
+	if (p == MAP_FAILED) {
+		goto fail;
+	}
+	memcpy( &hdr, p, sizeof(hdr) );
+	munmap( p, sizeof(hdr) );
+
+	if (hdr.magic != STOCH_MAP_MAGIC || hdr.version != STOCH_MAP_VERSION) {
+		errno = EPROTO;
+		goto fail;
+	}
+
+	m->size = sizeof(struct stoch_map) + hdr.nrows * sizeof(struct stoch_map_table);
+	p = mmap( NULL, m->size, PROT_READ, MAP_SHARED, m->fd, 0 );
+	if (p == MAP_FAILED) {
+		goto fail;
+	}
+	m->map = p;
+
+	stochmap_seed( m );
+
+	return 0;
+
+fail:
+	err = errno;
+	close( m->fd );
+	m->fd = -1;
+	errno = err;
+	return -1;
+}
+
+void stochmap_close( struct stochmap *m ) {
+	if (m->map) {
+		munmap( (void *)m->map, m->size );
+		m->map = NULL;
+	}
+	if (m->fd >= 0) {
+		close( m->fd );
+		m->fd = -1;
+	}
+}
+
+size_t stochmap_gen( struct stochmap *m, unsigned char *buf, size_t size ) {
+	const struct stoch_map *map = m->map;
+	const struct stoch_map_table *t;
+	size_t i;
+	int val;
+
+	if (map->nrows > 1 && !m->started) {
+		val = stochmap_val( map, &map->start, stochmap_rand( m ) );
+		if (val < 0) {
+			return 0;
+		}
+		m->prev = val;
+		m->started = 1;
+	}
+
+	for (i = 0; i < size; i++) {
+		t = (map->nrows > 1) ? &map->rows[m->prev] : &map->rows[0];
+		val = stochmap_val( map, t, stochmap_rand( m ) );
+		if (val <= 0) {
+			// an empty row ends the chain like a generated 0
+			m->started = 0;
+			break;
+		}
+		buf[i] = val;
+		m->prev = val;
+	}
+
+	return i;
+}
@@ -0,0 +1,43 @@
+/*
+ * Userspace sampling from a memory mapped stoch device.
+ * Generates output from the live model without a syscall per read, see
+ * stochdev.h for the layout of the mapping.
+ *
+ * struct stochmap m;
+ * unsigned char buf[64];
+ *
+ * if (stochmap_open( &m, "/dev/stoch" ) == 0) {
+ *	n = stochmap_gen( &m, buf, sizeof(buf) );
+ *	stochmap_close( &m );
+ * }
+ */
+
+#ifndef STOCHMAP_H
+#define STOCHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stochdev.h"
+
+struct stochmap {
+	int fd;
+	const struct stoch_map *map;
+	size_t size;
+	uint64_t rng[4]; /* xoshiro256** state */
+	unsigned int prev; /* chain state when the map has one row per byte */
+	int started;
+};
+
+/* map the device at path, returns 0 or -1 with errno set */
+int stochmap_open( struct stochmap *m, const char *path );
+void stochmap_close( struct stochmap *m );
+
+/*
+ * Fill buf like read(2) on the device: generation stops at the first 0
+ * byte, and the number of bytes before it is returned. For order 1 the
+ * chain carries on across calls.
+ */
+size_t stochmap_gen( struct stochmap *m, unsigned char *buf, size_t size );
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ * Userspace benchmark of the stoch core, linked against libstoch.a.
+ * Times drawing from the uniform, Zipf and single-symbol distributions with
+ * every sampler, then counts a corpus into an order 0 or order 1 table, or
+ * above that the table of contexts, and times training and chain
+ * generation over it. Last it alternates training and generating blocks of
+ * growing size, where every block makes the table based samplers rebuild
+ * the rows it touched while fenwick updates its trees in place, to show
+ * where each wins. Contexts are trained and drawn from in place whatever
+ * the sampler, so above order 1 there is one "sparse" column. No module is
+ * needed, so it is the quickest way to measure a change to stoch_core.c.
+ *
+ * $ make stochperf
+ * $ ./stochperf [-n iterations] [-o order] [-f corpus]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "stoch.h"
+
+static double perf_now( void ) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// read the whole corpus, or make up some text-like data if there is none
+static unsigned char *perf_corpus( const char *path, size_t *size ) {
+	static const char *words[] = { "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ", "hello ", "\n" };
+	unsigned char *buf;
+	size_t i, j, n;
+	const char *w;
+	FILE *f;
+	long len;
+
+	if (path) {
+		f = fopen( path, "rb" );
+		if (!f) {
+			perror( path );
+			exit( 1 );
+		}
+		fseek( f, 0, SEEK_END );
+		len = ftell( f );
+		fseek( f, 0, SEEK_SET );
+		buf = malloc( len > 0 ? len : 1 );
+		if (!buf || fread( buf, 1, len, f ) != (size_t)len) {
+			perror( path );
+			exit( 1 );
+		}
+		fclose( f );
+		*size = len;
+		return buf;
+	}
+
+	*size = 1 << 20;
+	buf = malloc( *size );
+	if (!buf) {
+		perror( "malloc" );
+		exit( 1 );
+	}
+	srand( 1 );
+	i = 0;
+	while (i < *size) {
+		w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		n = strlen( w );
+		for (j = 0; j < n && i < *size; j++) {
+			buf[i++] = w[j];
+		}
+	}
+	return buf;
+}
+
+// time single draws from h with every sampler, building each one's table into d in turn, or from its tree f
+static void perf_sample( const char *name, struct _stoch_hist *h, struct _stoch_dist *d, const struct _stoch_fenwick *f,
+			 struct _stoch_build *b, unsigned long long iters ) {
+	struct _stoch_rng rng;
+	unsigned long long i;
+	unsigned int sink;
+	double start, ns;
+	int s;
+
+	for (s = 0; s < STOCH_SAMPLER_COUNT; s++) {
+		if (s != STOCH_SAMPLER_FENWICK) {
+			stoch_dist_build( d, NULL, h, s, b );
+		}
+		stoch_rng_init( &rng, STOCH_RNG_FAST );
+		sink = 0;
+		start = perf_now();
+		for (i = 0; i < iters; i++) {
+			if (s == STOCH_SAMPLER_FENWICK) {
+				sink += stoch_fenwick_val( f, &rng );
+			} else {
+				sink += stoch_dist_val( s, d, &rng );
+			}
+		}
+		ns = (perf_now() - start) * 1e9 / iters;
+		printf( "%8s %8s %8s %12.2f\n", name, "sample", stoch_sampler_names[s], ns );
+
+		// keep the loop from being optimised away
+		if (sink == 1) {
+			printf( "\n" );
+		}
+	}
+}
+
+// samplers to time at order, above order 1 the sampler makes no difference
+static int perf_samplers( int order ) {
+	return (order > 1) ? 1 : STOCH_SAMPLER_COUNT;
+}
+
+static const char *perf_sampler_name( int order, int s ) {
+	return (order > 1) ? "sparse" : stoch_sampler_names[s];
+}
+
+// zeroed memory with the cache line alignment the core structures ask for
+static void *perf_zalloc( size_t size ) {
+	void *p;
+
+	p = aligned_alloc( 64, (size + 63) & ~(size_t)63 );
+	if (!p) {
+		perror( "aligned_alloc" );
+		exit( 1 );
+	}
+	return memset( p, 0, size );
+}
+
+/*
+ * The trained model, as the module keeps it: published rows and start
+ * state for the table samplers, trees for fenwick, or contexts above
+ * order 1.
+ */
+struct perf_model {
+	int order;
+	struct _stoch_ctxs ctxs;
+	unsigned int nrows;
+	struct _stoch_crow *crows[STOCH_HIST_SIZE]; // what training folds into
+	struct _stoch_count *cnt;
+	unsigned long touched[STOCH_HIST_SIZE / BITS_PER_LONG];
+	struct _stoch_dist *table;
+	struct _stoch_dist *rows[STOCH_HIST_SIZE];
+	int sampler; // the rows are built for
+	struct _stoch_hist starts; // the row totals the start state is built from
+	struct _stoch_dist start;
+	struct _stoch_fenwick *fen; // nrows row trees, then the start-state tree
+	struct _stoch_build build;
+};
+
+static void perf_model_init( struct perf_model *pm, int order ) {
+	unsigned int i;
+
+	memset( pm, 0, sizeof(*pm) );
+	pm->order = order;
+	if (order > 1) {
+		if (stoch_ctxs_init( &pm->ctxs, order ) < 0) {
+			perror( "stoch_ctxs_init" );
+			exit( 1 );
+		}
+		return;
+	}
+
+	pm->nrows = order ? STOCH_HIST_SIZE : 1;
+	pm->cnt = perf_zalloc( STOCH_COUNT_SIZE( pm->nrows ) );
+	pm->table = perf_zalloc( pm->nrows * sizeof(*pm->table) );
+	pm->fen = perf_zalloc( (pm->nrows + 1) * sizeof(*pm->fen) );
+	for (i = 0; i < pm->nrows; i++) {
+		pm->rows[i] = &pm->table[i];
+	}
+}
+
+static void perf_model_free( struct perf_model *pm ) {
+	unsigned int i;
+
+	if (pm->order > 1) {
+		stoch_ctxs_free( &pm->ctxs );
+		return;
+	}
+
+	for (i = 0; i < pm->nrows; i++) {
+		free( pm->crows[i] );
+	}
+	free( pm->cnt );
+	free( pm->table );
+	free( pm->fen );
+}
+
+// fold a counted block into the rows, widening them the way the module does
+static void perf_model_fold( struct perf_model *pm, const unsigned long *block ) {
+	struct _stoch_crow *r;
+	unsigned int i, shift;
+
+	for (i = 0; i < pm->nrows; i++) {
+		if (!(block[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG)))) {
+			continue;
+		}
+
+		r = pm->crows[i];
+		if (!r || stoch_crow_add( r, pm->cnt->rows[i], 0 ) < 0) {
+			shift = stoch_crow_fit( r, pm->cnt->rows[i], 0 );
+			r = perf_zalloc( STOCH_CROW_SIZE( shift ) );
+			stoch_crow_widen( r, shift, pm->crows[i] );
+			free( pm->crows[i] );
+			pm->crows[i] = r;
+			stoch_crow_add( r, pm->cnt->rows[i], 0 );
+		}
+		pm->touched[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+	}
+}
+
+static u64 perf_model_train( struct perf_model *pm, int sampler, u64 prev, const unsigned char *buff, size_t size ) {
+	unsigned long block[STOCH_HIST_SIZE / BITS_PER_LONG];
+	size_t i, n;
+
+	if (pm->order > 1) {
+		if (stoch_ctxs_train( &pm->ctxs, &prev, buff, size ) != (ssize_t)size) {
+			fprintf( stderr, "stochperf: out of memory for contexts\n" );
+			exit( 1 );
+		}
+		return prev;
+	}
+
+	if (sampler == STOCH_SAMPLER_FENWICK) {
+		return stoch_fenwick_count( pm->fen, &pm->fen[pm->nrows], pm->nrows - 1, prev, buff, size );
+	}
+
+	for (i = 0; i < size; i += n) {
+		n = min_t( size_t, size - i, STOCH_COUNT_BLOCK );
+		memset( block, 0, sizeof(block) );
+		prev = stoch_hist_count( pm->cnt, pm->nrows - 1, prev, buff + i, n, block );
+		perf_model_fold( pm, block );
+	}
+	return prev;
+}
+
+// rebuild the rows training touched for sampler, or all of them for a new one, and the start state, the way the module does on read
+static void perf_model_publish( struct perf_model *pm, int sampler ) {
+	const struct _stoch_dist *prev;
+	unsigned int i, j;
+
+	// contexts are drawn from as they are trained
+	if (pm->order > 1) {
+		return;
+	}
+
+	prev = NULL;
+	for (i = 0; i < pm->nrows; i++) {
+		if (sampler == pm->sampler) {
+			if (!(pm->touched[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG)))) {
+				continue;
+			}
+			prev = &pm->table[i];
+		} else if (!pm->crows[i]) {
+			continue;
+		}
+		for (j = 0; j < STOCH_HIST_SIZE; j++) {
+			pm->build.w[j] = stoch_crow_get( pm->crows[i], j );
+		}
+		stoch_hist_set( &pm->build.hist, pm->build.w );
+		stoch_dist_build( &pm->table[i], prev, &pm->build.hist, sampler, &pm->build );
+		pm->starts.data[i] = pm->table[i].qalias.total;
+	}
+	pm->sampler = sampler;
+	memset( pm->touched, 0, sizeof(pm->touched) );
+	stoch_dist_build( &pm->start, &pm->start, &pm->starts, STOCH_SAMPLER_ALIAS, &pm->build );
+}
+
+// continue a chain into buff with any sampler, returns the bytes before a 0
+static size_t perf_model_gen( struct perf_model *pm, int sampler, struct _stoch_chain *c,
+			      unsigned char *buff, size_t size ) {
+	unsigned char prev;
+	size_t i;
+
+	if (pm->order > 1) {
+		return stoch_ctxs_gen( &pm->ctxs, c, buff, size );
+	}
+
+	if (!c->started) {
+		if (sampler != STOCH_SAMPLER_FENWICK) {
+			stoch_chain_start( c, &pm->start );
+		} else if (stoch_fenwick_total( &pm->fen[pm->nrows] )) {
+			c->ctx = stoch_fenwick_val( &pm->fen[pm->nrows], &c->rng );
+			c->started = 1;
+		}
+		if (!c->started) {
+			return 0;
+		}
+	}
+
+	if (sampler != STOCH_SAMPLER_FENWICK) {
+		return stoch_chain_gen( c, sampler, pm->rows, pm->nrows - 1, buff, size );
+	}
+
+	prev = (unsigned char)c->ctx;
+	for (i = 0; i < size; i++) {
+		buff[i] = stoch_fenwick_val( &pm->fen[prev & (pm->nrows - 1)], &c->rng );
+		prev = buff[i];
+		if (buff[i] == 0) {
+			c->started = 0;
+			break;
+		}
+	}
+	c->ctx = prev;
+
+	return i;
+}
+
+// time chains generated from the trained model with every sampler, publishing its rows for each
+static void perf_chain( struct perf_model *pm, unsigned long long iters ) {
+	struct _stoch_chain c;
+	unsigned char buf[4096];
+	unsigned long long n;
+	double t0, ns;
+	size_t got;
+	int s;
+
+	for (s = 0; s < perf_samplers( pm->order ); s++) {
+		if (s != STOCH_SAMPLER_FENWICK) {
+			perf_model_publish( pm, s );
+		}
+		stoch_rng_init( &c.rng, STOCH_RNG_FAST );
+		c.started = 0;
+		n = 0;
+		t0 = perf_now();
+		while (n < iters) {
+			got = perf_model_gen( pm, s, &c, buf, sizeof(buf) );
+			n += got + (got < sizeof(buf));
+		}
+		ns = (perf_now() - t0) * 1e9 / n;
+		printf( "%8s %8s %8s %12.2f\n", "corpus", "chain", perf_sampler_name( pm->order, s ), ns );
+	}
+}
+
+/*
+ * Alternate training on a block of the corpus and generating a block of
+ * output, for growing block sizes. Prints ns per byte trained and
+ * generated for every sampler.
+ */
+static void perf_interleave( const unsigned char *corpus, size_t size, int order ) {
+	static const size_t blocks[] = { 1, 4, 16, 64, 256, 1024, 4096 };
+	struct perf_model *pm;
+	struct _stoch_chain c;
+	unsigned char buf[4096];
+	size_t b, r, rounds, off, done, got;
+	double t0;
+	u64 prev;
+	int s;
+
+	pm = perf_zalloc( sizeof(*pm) );
+
+	printf( "\n%8s", "block" );
+	for (s = 0; s < perf_samplers( order ); s++) {
+		printf( " %8s", perf_sampler_name( order, s ) );
+	}
+	printf( "   ns/byte trained and generated\n" );
+
+	for (b = 0; b < ARRAY_SIZE( blocks ); b++) {
+		rounds = size / blocks[b];
+		if (rounds > (1 << 14)) {
+			rounds = 1 << 14;
+		}
+		if (rounds == 0) {
+			break;
+		}
+
+		printf( "%8zu", blocks[b] );
+		for (s = 0; s < perf_samplers( order ); s++) {
+			perf_model_init( pm, order );
+			stoch_rng_init( &c.rng, STOCH_RNG_FAST );
+			c.started = 0;
+			prev = 0;
+			off = 0;
+
+			t0 = perf_now();
+			for (r = 0; r < rounds; r++) {
+				prev = perf_model_train( pm, s, prev, corpus + off, blocks[b] );
+				off += blocks[b];
+				if (s != STOCH_SAMPLER_FENWICK) {
+					perf_model_publish( pm, s );
+				}
+
+				// a 0 ends a chain, count it and start another
+				for (done = 0; done < blocks[b]; done += got + (got < blocks[b] - done)) {
+					got = perf_model_gen( pm, s, &c, buf, blocks[b] - done );
+				}
+			}
+			printf( " %8.2f", (perf_now() - t0) * 1e9 / (rounds * blocks[b]) );
+
+			perf_model_free( pm );
+		}
+		printf( "\n" );
+	}
+
+	free( pm );
+}
+
+static void usage( void ) {
+	printf( "Usage: stochperf [-n iterations] [-o order] [-f corpus]\n" );
+	exit( 1 );
+}
+
+int main( int argc, char **argv ) {
+	static const char *dists[] = { "live", "uniform", "zipf", "single" };
+	unsigned long long iters = 10000000;
+	const char *path = NULL;
+	int order = 1;
+	struct perf_model *pm;
+	struct _stoch_hist hist;
+	struct _stoch_dist syn;
+	struct _stoch_fenwick fen;
+	struct _stoch_build build;
+	unsigned char *corpus;
+	size_t size, passes, p;
+	double t0, ns;
+	int d, s, opt;
+
+	while ((opt = getopt( argc, argv, "n:o:f:h" )) != -1) {
+		switch (opt) {
+		case 'n':
+			iters = strtoull( optarg, NULL, 0 );
+			break;
+		case 'o':
+			order = atoi( optarg );
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (iters == 0 || order < 0 || order > STOCH_ORDER_MAX) {
+		usage();
+	}
+
+	printf( "%8s %8s %8s %12s\n", "dist", "op", "sampler", "ns/op" );
+	for (d = STOCH_BENCH_UNIFORM; d <= STOCH_BENCH_SINGLE; d++) {
+		stoch_hist_synth( &hist, d );
+		stoch_fenwick_build( &fen, &hist );
+		perf_sample( dists[d], &hist, &syn, &fen, &build, iters );
+	}
+
+	corpus = perf_corpus( path, &size );
+	if (size == 0) {
+		return 0;
+	}
+	pm = perf_zalloc( sizeof(*pm) );
+	perf_model_init( pm, order );
+
+	// train the tables and the trees, or the contexts, from the corpus, enough passes to cover iters bytes
+	passes = (iters + size - 1) / size;
+	for (s = STOCH_SAMPLER_SCAN; s <= STOCH_SAMPLER_FENWICK; s += STOCH_SAMPLER_FENWICK) {
+		t0 = perf_now();
+		for (p = 0; p < passes; p++) {
+			perf_model_train( pm, s, 0, corpus, size );
+		}
+		ns = (perf_now() - t0) * 1e9 / ((double)passes * size);
+		printf( "%8s %8s %8s %12.2f\n", "corpus", "train", (order > 1) ? "sparse" : s ? "fenwick" : "-", ns );
+		if (order > 1) {
+			break;
+		}
+	}
+
+	perf_chain( pm, iters );
+
+	perf_interleave( corpus, size, order );
+
+	perf_model_free( pm );
+	free( pm );
+	free( corpus );
+	return 0;
+}